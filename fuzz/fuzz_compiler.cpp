@@ -0,0 +1,59 @@
+// libFuzzer/AFL entry point for a whole compile: the input is compiled as a
+// single class, and if it has no errors, optimized with the -O2 pipeline and
+// --intern-strings and translated to Hack assembly and machine code.
+
+#include "fuzz_limits.h"
+#include "../src/tokenizer.cpp"
+#include "../src/compiler.cpp"
+#include "../src/interface.cpp"
+#include "../src/passes.cpp"
+#include "../src/hack_backend.cpp"
+#include "../src/hack_assembler.cpp"
+#include <cstdint>
+#include <cstddef>
+
+// the passes keep a reference to the options and libraries
+static Options options;
+static VmProgram libraries;
+static PassManager passes;
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+    silence_output();
+    options.optimization_level = 2;
+    options.intern_strings = true;
+    register_passes(passes, options, nullptr, libraries);
+    select_passes(passes, options, nullptr);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size > MAX_FUZZ_INPUT) return -1;
+    string source(reinterpret_cast<const char*>(data), size);
+
+    Diagnostics diagnostics(DEFAULT_MAX_ERRORS, false);
+    Tokenizer t("Fuzz.jack", source, diagnostics);
+    Compiler c(t, diagnostics);
+    VmProgram program;
+    program.classes.push_back(c.compile());
+
+    InterfaceTable interfaces;
+    interfaces[c.interface().name] = &c.interface();
+    unordered_map<string, uint64_t> dependencies;
+    check_calls(c.call_sites(), interfaces, diagnostics, dependencies);
+    if (diagnostics.errors() > 0) {
+        discard_log();
+        return 0;
+    }
+
+    passes.run(program);
+
+    for (bool optimize : {false, true}) {
+        HackBackend backend(true, optimize);
+        vector<string> lines = backend.translate(program);
+        HackAssembler assembler;
+        vector<string> binary;
+        assembler.assemble(lines, binary);
+    }
+    discard_log();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef FUZZ_LIMITS_H
+#define FUZZ_LIMITS_H
+
+#include "../src/log.cpp"
+#include <cstddef>
+#include <iostream>
+
+// Inputs above this size are rejected, so that a slow input points at
+// super-linear behaviour rather than at sheer size. Run the fuzzers with
+// -max_len at or below it.
+static const size_t MAX_FUZZ_INPUT = 64 * 1024;
+
+// The compiler reports progress and errors on cout; writing them out would
+// make every run I/O bound. Only errors are still logged.
+inline void silence_output() {
+    std::cout.rdbuf(nullptr);
+    std::cerr.rdbuf(nullptr);
+    Log::set_level(LogLevel::ERROR);
+}
+
+// Drops what an input logged. The log keeps messages until it is flushed, so
+// without this it would grow with every run and end in a false out-of-memory
+// report.
+inline void discard_log() {
+    Log::flush();
+}
+
+#endif // FUZZ_LIMITS_H
\ No newline at end of file
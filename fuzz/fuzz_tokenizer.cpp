@@ -0,0 +1,28 @@
+// libFuzzer/AFL entry point for the tokenizer: splits the input into tokens
+// and walks them the way the compiler does.
+
+#include "fuzz_limits.h"
+#include "../src/tokenizer.cpp"
+#include <cstdint>
+#include <cstddef>
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+    silence_output();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size > MAX_FUZZ_INPUT) return -1;
+    string source(reinterpret_cast<const char*>(data), size);
+
+    Diagnostics diagnostics(0, false);
+    Tokenizer t("Fuzz.jack", source, diagnostics);
+    while (!t.at_end()) {
+        t.line();
+        t.column();
+        t.look_ahead(1);
+        t.advance();
+    }
+    discard_log();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+// Driver for the fuzz entry points without libFuzzer: runs each file given on
+// the command line, or standard input if there are none, through
+// LLVMFuzzerTestOneInput. Built with afl-g++/afl-clang++ it is an AFL target
+// (afl-fuzz ... -- target/fuzz_compiler_standalone @@); built with a plain
+// compiler it replays a corpus or a crash and prints how long each input took.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv);
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static int run(const string& name, const string& input) {
+    auto start = chrono::steady_clock::now();
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    auto elapsed = chrono::steady_clock::now() - start;
+    printf("%8lld ms  %s\n", static_cast<long long>(chrono::duration_cast<chrono::milliseconds>(elapsed).count()), name.c_str());
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    LLVMFuzzerInitialize(&argc, &argv);
+    if (argc < 2) {
+        stringstream input;
+        input << cin.rdbuf();
+        return run("<stdin>", input.str());
+    }
+    for (int i = 1; i < argc; i++) {
+        ifstream file(argv[i], ios::binary);
+        if (!file.is_open()) {
+            printf("Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        stringstream input;
+        input << file.rdbuf();
+        run(argv[i], input.str());
+    }
+    return 0;
+}
\ No newline at end of file
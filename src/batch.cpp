@@ -0,0 +1,195 @@
+#ifndef BATCH_CPP
+#define BATCH_CPP
+
+#include "constants.h"
+#include "log.cpp"
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+#include <filesystem>
+
+using namespace std;
+namespace fs = filesystem;
+
+// Stream buffer for cout and cerr that appends what a thread writes to that
+// thread's capture string, if it has one, and otherwise passes it on to the
+// original buffer. This keeps the output of programs that are compiled in
+// parallel apart.
+class ThreadOutputBuffer : public streambuf
+{
+public:
+    static const int STREAMS = 2;
+
+    ThreadOutputBuffer(ostream& stream, int index) {
+        this->stream = &stream;
+        this->index = index;
+        original = stream.rdbuf(this);
+    }
+
+    ~ThreadOutputBuffer() {
+        stream->rdbuf(original);
+    }
+
+    // Sets where the calling thread's output goes, or nullptr to write it
+    // straight through.
+    static void capture(string* out, string* err) {
+        captures[0] = out;
+        captures[1] = err;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (c == EOF) return 0;
+        char character = static_cast<char>(c);
+        return xsputn(&character, 1) == 1 ? c : EOF;
+    }
+
+    streamsize xsputn(const char* data, streamsize count) override {
+        if (captures[index] != nullptr) {
+            captures[index]->append(data, count);
+            return count;
+        }
+        lock_guard<mutex> lock(write_mutex);
+        return original->sputn(data, count);
+    }
+
+    int sync() override {
+        if (captures[index] != nullptr) return 0;
+        lock_guard<mutex> lock(write_mutex);
+        return original->pubsync();
+    }
+
+private:
+    ostream* stream;
+    streambuf* original;
+    int index;
+    mutex write_mutex;
+
+    static thread_local string* captures[STREAMS];
+};
+
+thread_local string* ThreadOutputBuffer::captures[ThreadOutputBuffer::STREAMS] = {nullptr, nullptr};
+
+struct ProjectResult {
+    fs::path path;
+    int status = 0;
+    long long milliseconds = 0;
+    string output;
+    string errors;
+    string warnings;
+};
+
+// Reads the roots listed in a manifest, one per line. Blank lines and lines
+// starting with # are skipped; relative paths are relative to the manifest.
+bool read_manifest(const fs::path& manifest, vector<fs::path>& roots) {
+    ifstream input(manifest);
+    if (!input.is_open()) {
+        LOG_ERROR("Failed to open manifest: " << manifest.string());
+        return false;
+    }
+    string line;
+    while (getline(input, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line.front() == '#') continue;
+        fs::path root = line;
+        roots.push_back(root.is_relative() ? manifest.parent_path() / root : root);
+    }
+    return true;
+}
+
+// Every directory under the roots that holds .jack files is a program of its
+// own; a root that is a .jack file is compiled on its own.
+vector<fs::path> discover_projects(const vector<fs::path>& roots, const string& source_type) {
+    set<fs::path> projects;
+    for (const auto& root : roots) {
+        if (fs::is_regular_file(root) && root.extension() == source_type) {
+            projects.insert(root);
+        } else if (fs::is_directory(root)) {
+            for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied)) {
+                if (entry.is_regular_file() && entry.path().extension() == source_type) {
+                    projects.insert(entry.path().parent_path());
+                }
+            }
+        } else {
+            LOG_ERROR("Invalid argument: " << root);
+        }
+    }
+    return vector<fs::path>(projects.begin(), projects.end());
+}
+
+// Compiles every project with compile on a pool of jobs threads (0 for one
+// per hardware thread) and prints a summary with the status and time of each.
+// The errors and warnings of every project are shown, the rest of its output
+// only if it failed. Returns 1 if any did.
+int run_batch(const vector<fs::path>& projects, int jobs, const function<int(const fs::path&)>& compile) {
+    if (jobs <= 0) jobs = max(1u, thread::hardware_concurrency());
+    jobs = min<int>(jobs, max<size_t>(projects.size(), 1));
+
+    vector<ProjectResult> results(projects.size());
+    atomic<size_t> next(0);
+    auto start = chrono::steady_clock::now();
+    {
+        ThreadOutputBuffer out(cout, 0);
+        ThreadOutputBuffer err(cerr, 1);
+        vector<thread> workers;
+        for (int i = 0; i < jobs; i++) {
+            workers.emplace_back([&]() {
+                for (size_t project = next++; project < projects.size(); project = next++) {
+                    ProjectResult& result = results[project];
+                    result.path = projects[project];
+                    ThreadOutputBuffer::capture(&result.output, &result.errors);
+                    Log::copy_warnings(&result.warnings);
+                    auto project_start = chrono::steady_clock::now();
+                    try {
+                        result.status = compile(result.path);
+                    } catch (const exception& e) {
+                        LOG_ERROR("Internal error: " << e.what());
+                        Log::flush();
+                        result.status = 1;
+                    }
+                    auto elapsed = chrono::steady_clock::now() - project_start;
+                    result.milliseconds = chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+                    Log::copy_warnings(nullptr);
+                    ThreadOutputBuffer::capture(nullptr, nullptr);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    int failed = 0;
+    for (const auto& result : results) {
+        if (result.status == 0) {
+            if (!result.warnings.empty() || !result.errors.empty()) {
+                cout << "== " << result.path.string() << '\n' << result.warnings;
+                cerr << result.errors;
+            }
+            continue;
+        }
+        failed++;
+        cout << "== " << result.path.string() << '\n' << result.output;
+        cerr << result.errors;
+    }
+    for (const auto& result : results) {
+        cout << left << setw(7) << (result.status == 0 ? "ok" : "FAILED") << right
+             << setw(7) << result.milliseconds << " ms  " << result.path.string() << '\n';
+    }
+    cout << "Compiled " << results.size() << " programs in "
+         << chrono::duration_cast<chrono::milliseconds>(elapsed).count() << " ms on " << jobs << (jobs == 1 ? " thread: " : " threads: ")
+         << results.size() - failed << " ok, " << failed << " failed." << '\n';
+    return failed > 0 ? 1 : 0;
+}
+
+#endif // BATCH_CPP
\ No newline at end of file
@@ -0,0 +1,251 @@
+#ifndef CFG_CPP
+#define CFG_CPP
+
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+// A run of VM commands that is only entered at the top and only left at the
+// bottom. The labels that name the block are kept apart from its body; a
+// jump or return can only be the last command of the body.
+struct BasicBlock {
+    vector<string> labels;
+    vector<VmInstruction> body;
+
+    // the goto, if-goto or return that ends the block, or null
+    const VmInstruction* terminator() const {
+        if (body.empty()) return nullptr;
+        const VmInstruction& last = body.back();
+        return last.is_jump() || last.op == VmOp::RETURN ? &last : nullptr;
+    }
+
+    bool falls_through() const {
+        const VmInstruction* last = terminator();
+        return last == nullptr || last->op == VmOp::IF_GOTO;
+    }
+};
+
+// Control-flow graph of a function body. Blocks are kept in layout order, so
+// the block a block falls through to is always the next one; blocks[0] is the
+// entry. The graph can be changed and turned back into VM commands with
+// to_instructions.
+class ControlFlowGraph
+{
+public:
+    vector<BasicBlock> blocks;
+
+    ControlFlowGraph(const vector<VmInstruction>& body) {
+        blocks.push_back({});
+        for (const auto& instruction : body) {
+            if (instruction.op == VmOp::LABEL) {
+                if (!blocks.back().body.empty()) blocks.push_back({});
+                blocks.back().labels.push_back(instruction.name);
+                continue;
+            }
+            blocks.back().body.push_back(instruction);
+            if (instruction.is_jump() || instruction.op == VmOp::RETURN) {
+                blocks.push_back({});
+            }
+        }
+        if (blocks.size() > 1 && blocks.back().labels.empty() && blocks.back().body.empty()) {
+            blocks.pop_back();
+        }
+        index_labels();
+    }
+
+    // Block a label belongs to, or -1 if the function has no such label.
+    int block_of(const string& label) const {
+        auto entry = label_blocks.find(label);
+        return entry == label_blocks.end() ? -1 : entry->second;
+    }
+
+    // Blocks control can go to from block: the jump target first, then the
+    // next block if control can fall through to it.
+    vector<int> successors(int block) const {
+        vector<int> result;
+        const VmInstruction* last = blocks[block].terminator();
+        if (last != nullptr && last->is_jump()) {
+            int target = block_of(last->name);
+            if (target >= 0) result.push_back(target);
+        }
+        if (blocks[block].falls_through() && block + 1 < (int)blocks.size()) {
+            result.push_back(block + 1);
+        }
+        return result;
+    }
+
+    vector<vector<int>> predecessors() const {
+        vector<vector<int>> result(blocks.size());
+        for (int i = 0; i < (int)blocks.size(); i++) {
+            for (int successor : successors(i)) {
+                result[successor].push_back(i);
+            }
+        }
+        return result;
+    }
+
+    vector<bool> reachable() const {
+        vector<bool> result(blocks.size(), false);
+        vector<int> work = {0};
+        result[0] = true;
+        while (!work.empty()) {
+            int block = work.back();
+            work.pop_back();
+            for (int successor : successors(block)) {
+                if (!result[successor]) {
+                    result[successor] = true;
+                    work.push_back(successor);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Points jumps to a block that only holds a goto straight at the final
+    // target. Returns the number of jumps changed.
+    int thread_jumps() {
+        int changed = 0;
+        for (auto& block : blocks) {
+            if (block.body.empty() || !block.body.back().is_jump()) continue;
+            VmInstruction& jump = block.body.back();
+
+            int first = block_of(jump.name);
+            int target = first;
+            int steps = 0;
+            while (target >= 0 && is_goto_only(blocks[target]) && steps++ < (int)blocks.size()) {
+                int next = block_of(blocks[target].body.back().name);
+                if (next < 0 || next == target) break;
+                target = next;
+            }
+            if (target != first) {
+                jump.name = blocks[target].labels.front();
+                changed++;
+            }
+        }
+        return changed;
+    }
+
+    // Returns the number of VM commands removed.
+    int remove_unreachable() {
+        vector<bool> keep = reachable();
+        vector<BasicBlock> kept;
+        int removed = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (keep[i]) {
+                kept.push_back(blocks[i]);
+            } else {
+                removed += blocks[i].body.size();
+            }
+        }
+        blocks = kept;
+        index_labels();
+        return removed;
+    }
+
+    // Lays out chains of blocks that fall through to each other so that a
+    // chain ending in goto is followed by the chain it jumps to, which turns
+    // the goto into a fall-through. A chain that falls off the end of the
+    // function stays last.
+    void reorder_blocks() {
+        vector<vector<int>> chains;
+        vector<int> chain_of(blocks.size());
+        for (int i = 0; i < (int)blocks.size(); i++) {
+            if (i == 0 || !blocks[i - 1].falls_through()) chains.push_back({});
+            chains.back().push_back(i);
+            chain_of[i] = chains.size() - 1;
+        }
+        int last_chain = blocks.back().falls_through() ? chains.size() - 1 : -1;
+
+        vector<bool> placed(chains.size(), false);
+        vector<int> order;
+        int chain = 0;
+        while (chain >= 0) {
+            placed[chain] = true;
+            order.push_back(chain);
+
+            const VmInstruction* last = blocks[chains[chain].back()].terminator();
+            int next = -1;
+            if (last != nullptr && last->op == VmOp::GOTO) {
+                int target = block_of(last->name);
+                if (target >= 0 && chains[chain_of[target]].front() == target && !placed[chain_of[target]] && chain_of[target] != last_chain) {
+                    next = chain_of[target];
+                }
+            }
+            for (int i = 0; next < 0 && i < (int)chains.size(); i++) {
+                if (!placed[i] && i != last_chain) next = i;
+            }
+            if (next < 0 && last_chain >= 0 && !placed[last_chain]) next = last_chain;
+            chain = next;
+        }
+
+        vector<BasicBlock> reordered;
+        for (int i : order) {
+            for (int block : chains[i]) {
+                reordered.push_back(blocks[block]);
+            }
+        }
+        blocks = reordered;
+        index_labels();
+    }
+
+    // VM commands of the graph. Labels nothing jumps to and gotos to the next
+    // block are left out.
+    vector<VmInstruction> to_instructions() const {
+        unordered_set<string> targets;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            const VmInstruction* last = blocks[i].terminator();
+            if (last != nullptr && last->is_jump() && !jumps_to_next(i)) targets.insert(last->name);
+        }
+
+        vector<VmInstruction> body;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            for (const auto& label : blocks[i].labels) {
+                if (targets.count(label) > 0) body.push_back(VmInstruction::label(label));
+            }
+            size_t length = blocks[i].body.size() - (jumps_to_next(i) ? 1 : 0);
+            body.insert(body.end(), blocks[i].body.begin(), blocks[i].body.begin() + length);
+        }
+        return body;
+    }
+
+private:
+    unordered_map<string, int> label_blocks;
+
+    void index_labels() {
+        label_blocks.clear();
+        for (size_t i = 0; i < blocks.size(); i++) {
+            for (const auto& label : blocks[i].labels) {
+                label_blocks[label] = i;
+            }
+        }
+    }
+
+    // whether block ends in a goto to the block right after it
+    bool jumps_to_next(size_t block) const {
+        const VmInstruction* last = blocks[block].terminator();
+        return last != nullptr && last->op == VmOp::GOTO && block_of(last->name) == (int)block + 1;
+    }
+
+    static bool is_goto_only(const BasicBlock& block) {
+        return block.body.size() == 1 && block.body.back().op == VmOp::GOTO;
+    }
+
+};
+
+// Removes unreachable code, threads jumps and lays out blocks to save taken
+// jumps. Returns the number of VM commands removed from the function.
+int simplify_control_flow(VmFunction& function) {
+    int size = function.body.size();
+    ControlFlowGraph graph(function.body);
+    graph.thread_jumps();
+    graph.remove_unreachable();
+    graph.reorder_blocks();
+    function.body = graph.to_instructions();
+    return size - function.body.size();
+}
+
+#endif // CFG_CPP
\ No newline at end of file
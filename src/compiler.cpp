@@ -4,7 +4,13 @@
 #include "constants.h"
 #include "tokenizer.cpp"
 #include "symbol_table.cpp"
+#include "vm_code.cpp"
+#include "profile.cpp"
+#include "interface.cpp"
+#include "log.cpp"
 #include <sstream>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <cassert>
 
@@ -14,71 +20,120 @@ using namespace std;
 class Compiler
 {
 public:
-    Compiler(Tokenizer& t) {
+    Compiler(Tokenizer& t, Diagnostics& diagnostics, const Profile* profile = nullptr) {
         this->t = &t;
+        this->diagnostics = &diagnostics;
+        this->profile = profile;
     }
 
-    string compile() {
+    // Errors are reported to diagnostics. After a syntax error the compiler
+    // skips to the next statement or declaration and goes on checking the
+    // rest of the class, but writes no more code, so the returned class is
+    // incomplete if there were any errors.
+    VmClass compile() {
         indent = "";
         writing_enabled = true;
-        bool compile_error = !compile_class();
-        output << flush;
+        compile_class();
+        return vm_class;
+    }
 
-        if (compile_error) {
-            cout << "Compilation error." << endl;
-        }
-        return output.str();
+    // What other classes see of the compiled class.
+    const ClassInterface& interface() const {
+        return class_interface;
+    }
+
+    // Calls to subroutines of named classes, to be checked against their
+    // interfaces once all classes are known.
+    const vector<CallSite>& call_sites() const {
+        return calls;
     }
 
 private:
     Tokenizer* t;
+    Diagnostics* diagnostics;
+    const Profile* profile;
     string indent;
     string class_name;
     bool writing_enabled;
 
-    stringstream output;
+    VmClass vm_class;
+    ClassInterface class_interface;
+    vector<CallSite> calls;
 
     SymbolTable class_table;
     SymbolTable subroutine_table;
 
-    int n_args_count;
     int while_label_count = 0;
     int if_label_count = 0;
 
     bool is_constructor;
 
+    int error_count = 0;
+    int nesting_depth = 0;
+
+    // Counts a level of nesting for as long as it lives, so that deeply
+    // nested input is reported instead of overflowing the stack.
+    struct NestingLevel {
+        int& depth;
+        NestingLevel(int& depth) : depth(depth) { depth++; }
+        ~NestingLevel() { depth--; }
+    };
+
+    bool too_deep(const string& what) {
+        if (nesting_depth < MAX_NESTING_DEPTH) return false;
+        error(what + " nested more than " + to_string(MAX_NESTING_DEPTH) + " levels deep");
+        return true;
+    }
+
     bool compile_class() {
         
 
-        if (t->peek() != "class") return false;
-        t->advance();
+        if (!expect("class")) return false;
 
         class_name = t->peek();
         if (!compile_identifier()) return false;
+        vm_class.name = class_name;
+        class_interface.name = class_name;
+
+        if (!expect("{")) return false;
+
+        bool has_subroutines = false;
+        while (t->peek() != "}" && !t->at_end()) {
+            size_t start = t->position();
+            int errors = error_count;
+            bool valid;
+            if (t->peek() == "static" || t->peek() == "field") {
+                if (has_subroutines) {
+                    error("class variables must be declared before subroutines");
+                }
+                valid = compile_class_var_dec();
+            } else if (is_subroutine_keyword(t->peek())) {
+                has_subroutines = true;
+                valid = compile_subroutine_dec();
+            } else {
+                error("expected a class variable or subroutine declaration, found " + found());
+                valid = false;
+            }
 
-        if (t->peek() != "{") return false;
-        t->advance();
-        
-        while (
-            t->peek() == "static" ||
-            t->peek() == "field")
-        {
-            if (!compile_class_var_dec()) return false;
+            if (!valid) {
+                if (diagnostics->limit_reached()) return false;
+                if (error_count == errors) {
+                    // a block was left open before the next declaration
+                    error("expected '}', found " + found());
+                }
+                skip_declaration(start);
+            }
         }
 
-        while (
-            t->peek() == "constructor" ||
-            t->peek() == "function" ||
-            t->peek() == "method")
-        {
-            if (!compile_subroutine_dec()) return false;
-        }
+        // the closing brace may have been skipped while recovering
+        if (t->at_end() && error_count > 0) return false;
+        if (!expect("}")) return false;
 
-        if (t->peek() != "}") return false;
-        t->advance();
+        class_interface.n_fields = class_table.var_count("field");
+        class_interface.n_statics = class_table.var_count("static");
+        vm_class.n_statics = class_interface.n_statics;
 
-        cout << "Class symbol table: " << endl;
-        class_table.print();
+        LOG_DEBUG("Class symbol table: " << class_name << class_table);
 
         
         return true;
@@ -105,8 +160,7 @@ private:
         class_table.define(name, type, kind);
 
         while (t->peek() == ",") {
-            if (t->peek() != ",") return false;
-            t->advance();
+            if (!expect(",")) return false;
 
             name = t->peek();
             if (!compile_identifier()) return false;
@@ -114,8 +168,7 @@ private:
             class_table.define(name, type, kind);
         }
 
-        if (t->peek() != ";") return false;
-        t->advance();
+        if (!expect(";")) return false;
 
         
         return true;
@@ -142,6 +195,7 @@ private:
         };
         t->advance();
 
+        string return_type = t->peek();
         if (t->peek() == "void") {
             t->advance();
         } else {
@@ -151,21 +205,21 @@ private:
         string subroutine_name = t->peek();
         if (!compile_identifier()) return false;
 
-        if (t->peek() != "(") return false;
-        t->advance();
+        if (!expect("(")) return false;
 
         if (!compile_parameter_list()) return false;
 
-        if (t->peek() != ")") return false;
-        t->advance();
+        if (!expect(")")) return false;
+
+        int n_params = subroutine_table.var_count("arg") - (keyword == "method" ? 1 : 0);
+        class_interface.subroutines.push_back({subroutine_name, keyword, return_type, n_params});
 
         if (!compile_subroutine_body(subroutine_name, keyword == "method")) return false;
 
         if_label_count = 0;
         while_label_count = 0;
 
-        cout << "Subroutine symbol table: " << subroutine_name << endl;
-        subroutine_table.print();
+        LOG_DEBUG("Subroutine symbol table: " << subroutine_name << subroutine_table);
         
         return true;
     }
@@ -183,8 +237,7 @@ private:
             subroutine_table.define(name, type, "arg");
 
             while (t->peek() == ",") {
-                if (t->peek() != ",") return false;
-                t->advance();
+                if (!expect(",")) return false;
 
                 string type = t->peek();
                 if (!compile_type()) return false;
@@ -201,14 +254,17 @@ private:
     }
 
     bool compile_subroutine_body(string subroutine_name, bool is_method) {
-        if (t->peek() != "{") return false;
-        t->advance();
+        if (!expect("{")) return false;
 
         while (t->peek() == "var") {
-            if (!compile_var_dec()) return false;
+            size_t start = t->position();
+            if (!compile_var_dec()) {
+                if (diagnostics->limit_reached()) return false;
+                skip_statement(start);
+            }
         }
 
-        write_function(subroutine_name, subroutine_table.var_count("var"));
+        write_function(subroutine_name, subroutine_table.var_count("var"), subroutine_table.var_count("arg"));
 
         if (is_constructor) {
             write_push("constant", to_string(class_table.var_count("field")));
@@ -221,21 +277,31 @@ private:
 
         if (!compile_statements()) return false;
 
-        if (t->peek() != "}") return false;
-        t->advance();
+        if (!expect("}")) return false;
         
         return true;
     }
 
+    // Compiles statements up to the closing brace of the block. A statement
+    // with a syntax error is skipped and compiling goes on with the next one;
+    // reaching a declaration keyword means the block was not closed.
     bool compile_statements() {
-        while (
-            t->peek() == "let" ||
-            t->peek() == "if" ||
-            t->peek() == "while" ||
-            t->peek() == "do" ||
-            t->peek() == "return")
-        {
-            if (!compile_statement()) return false;
+        if (too_deep("statements")) return false;
+        NestingLevel level(nesting_depth);
+
+        while (t->peek() != "}" && !t->at_end()) {
+            if (is_declaration_keyword(t->peek())) return false;
+
+            size_t start = t->position();
+            int errors = error_count;
+            if (!compile_statement()) {
+                if (diagnostics->limit_reached()) return false;
+                if (error_count == errors) {
+                    // a nested block ran into a declaration
+                    return false;
+                }
+                skip_statement(start);
+            }
         }
         
         return true;
@@ -257,6 +323,7 @@ private:
         else if (t->peek() == "return") {
             if (!compile_return_statement()) return false;
         } else {
+            error("expected a statement, found " + found());
             return false;
         }
 
@@ -266,8 +333,7 @@ private:
     bool compile_let_statement() {
         bool is_array = false;
 
-        if (t->peek() != "let") return false;
-        t->advance();
+        if (!expect("let")) return false;
 
         string var_name = t->peek();
         if (!compile_identifier()) return false;
@@ -283,37 +349,53 @@ private:
             var_index = to_string(class_table.index_of(var_name));
             segment = KIND_TO_SEGMENT.at(var_kind);
         } else {
-            cout << "Identifier '" << var_name << "' not recognized." << endl;
+            error("unknown identifier '" + var_name + "'");
         }
 
+        size_t address_start = current_size();
+        int offset = 0;
         if (t->peek() == "[") {
             is_array = true;
 
-            if (t->peek() != "[") return false;
-            t->advance();
+            if (!expect("[")) return false;
 
+            size_t index_start = current_size();
             if (!compile_expression()) return false;
 
-            write_push(segment, var_index);
-            write("add");
+            if (take_constant_index(index_start, offset)) {
+                write_push(segment, var_index);
+            } else if (is_stable_address(index_start)) {
+                // same order as an array read, so reads of this element in
+                // the value can be recognized
+                write_push(segment, var_index);
+                rotate_to(index_start);
+                write("add");
+            } else {
+                write_push(segment, var_index);
+                write("add");
+            }
 
-            if (t->peek() != "]") return false;
-            t->advance();
+            if (!expect("]")) return false;
         }
 
-        if (t->peek() != "=") return false;
-        t->advance();
+        if (!expect("=")) return false;
 
+        size_t value_start = current_size();
         if (!compile_expression()) return false;
 
-        if (t->peek() != ";") return false;
-        t->advance();
+        if (!expect(";")) return false;
 
         if (is_array) {
-            write_pop("temp", "0");
-            write_pop("pointer", "1");
-            write_push("temp", "0");
-            write_pop("that", "0");
+            if (writing_enabled && reuse_element_address(address_start, value_start)) {
+                // pointer 1 is set before the value is computed and the
+                // value does not change it
+                vm_class.functions.back().body.insert(vm_class.functions.back().body.begin() + value_start, VmInstruction::pop(Segment::POINTER, 1));
+            } else {
+                write_pop("temp", "0");
+                write_pop("pointer", "1");
+                write_push("temp", "0");
+            }
+            write_pop("that", to_string(offset));
         } else {
             write_pop(segment, var_index);
         }
@@ -321,55 +403,147 @@ private:
         return true;
     }
 
+    size_t current_size() {
+        return writing_enabled ? vm_class.functions.back().body.size() : 0;
+    }
+
+    // If the array index compiled from start on is a constant, removes it and
+    // returns it in offset, so it can go in the that index instead.
+    bool take_constant_index(size_t start, int& offset) {
+        if (!writing_enabled) return false;
+        vector<VmInstruction>& body = vm_class.functions.back().body;
+        if (body.size() != start + 1 || body.back().op != VmOp::PUSH || body.back().segment != Segment::CONSTANT) return false;
+        offset = body.back().index;
+        body.pop_back();
+        return true;
+    }
+
+    // Whether the code from start to end (by default the end of the body)
+    // only reads locals, arguments and constants, so it computes the same
+    // value anywhere in the statement.
+    bool is_stable_address(size_t start, size_t end = SIZE_MAX) {
+        if (!writing_enabled) return false;
+        const vector<VmInstruction>& body = vm_class.functions.back().body;
+        for (size_t i = start; i < min(end, body.size()); i++) {
+            const VmInstruction& instruction = body[i];
+            if (instruction.op == VmOp::PUSH) {
+                bool is_stable_segment = instruction.segment == Segment::CONSTANT ||
+                    instruction.segment == Segment::LOCAL || instruction.segment == Segment::ARGUMENT;
+                if (!is_stable_segment) return false;
+            } else if (!instruction.is_arithmetic()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Moves the last command to position start.
+    void rotate_to(size_t start) {
+        if (!writing_enabled) return;
+        vector<VmInstruction>& body = vm_class.functions.back().body;
+        rotate(body.begin() + start, body.end() - 1, body.end());
+    }
+
+    // An array store can set pointer 1 before computing the value if the
+    // value does not set it itself. Reads of the same element in the value
+    // (the address code followed by pop pointer 1) are turned into plain
+    // that accesses when the address is stable. Returns false, leaving the
+    // code as it was, when pointer 1 cannot be kept.
+    bool reuse_element_address(size_t address_start, size_t value_start) {
+        vector<VmInstruction>& body = vm_class.functions.back().body;
+        vector<VmInstruction> address(body.begin() + address_start, body.begin() + value_start);
+        vector<VmInstruction> value;
+        for (size_t i = value_start; i < body.size(); i++) {
+            value.push_back(body[i]);
+            if (!body[i].is(VmOp::POP, Segment::POINTER, 1)) continue;
+
+            bool same_element = value.size() > address.size() && is_stable_address(address_start, value_start) &&
+                equal(address.begin(), address.end(), value.end() - address.size() - 1, value.end() - 1, same_instruction);
+            if (!same_element) return false;
+            value.resize(value.size() - address.size() - 1);
+        }
+        body.resize(value_start);
+        body.insert(body.end(), value.begin(), value.end());
+        return true;
+    }
+
+    static bool same_instruction(const VmInstruction& a, const VmInstruction& b) {
+        return a.op == b.op && a.segment == b.segment && a.index == b.index && a.name == b.name;
+    }
+
     bool compile_if_statement() {
-        if (t->peek() != "if") return false;
-        t->advance();
+        if (!expect("if")) return false;
 
-        if (t->peek() != "(") return false;
-        t->advance();
+        if (!expect("(")) return false;
 
-        if (!compile_expression()) return false;
+        size_t condition_start = writing_enabled ? vm_class.functions.back().body.size() : 0;
+        int constant_value;
+        if (!compile_condition(constant_value)) return false;
 
-        if (t->peek() != ")") return false;
-        t->advance();
+        if (!expect(")")) return false;
 
         int label_count = if_label_count++;
         string cond_true_label = "IF_TRUE";
         cond_true_label.append(to_string(label_count));
-        write_if(cond_true_label);
-
         string cond_false_label = "IF_FALSE";
         cond_false_label.append(to_string(label_count));
-        write_goto(cond_false_label);
-        
-        write_label(cond_true_label);
-
-        if (t->peek() != "{") return false;
-        t->advance();
+        string end_label = "IF_END";
+        end_label.append(to_string(label_count));
 
-        if (!compile_statements()) return false;
+        if (constant_value >= 0) {
+            // only the arm that is taken is compiled into code
+            if (!compile_block(constant_value == 1)) return false;
+            if (t->peek() == "else") {
+                t->advance();
+                if (!compile_block(constant_value == 0)) return false;
+            }
+            return true;
+        }
 
-        if (t->peek() != "}") return false;
-        t->advance();
+        double true_probability = -1;
+        if (profile != nullptr && writing_enabled) {
+            true_probability = profile->if_true_probability(vm_class.functions.back().name, label_count);
+        }
 
-        string end_label = "IF_END";
-        end_label.append(to_string(label_count));
+        if (true_probability >= 0 && true_probability < 0.5 && has_else_arm()) {
+            // likely false: the else arm falls through and the then arm is
+            // moved behind it
+            write_if(cond_true_label);
+            size_t then_start = vm_class.functions.back().body.size();
+            if (!compile_block(true)) return false;
+            vector<VmInstruction>& body = vm_class.functions.back().body;
+            vector<VmInstruction> then_arm(body.begin() + then_start, body.end());
+            body.resize(then_start);
 
-        if (t->peek() == "else") {
-            if (t->peek() != "else") return false;
             t->advance();
+            if (!compile_block(true)) return false;
+            write_goto(end_label);
+            write_label(cond_true_label);
+            vm_class.functions.back().body.insert(vm_class.functions.back().body.end(), then_arm.begin(), then_arm.end());
+            write_label(end_label);
+            return true;
+        }
+
+        if (writing_enabled && is_boolean(condition_start)) {
+            // the then arm falls through
+            write_if_false(cond_false_label);
+        } else {
+            // any value other than 0 is true
+            write_if(cond_true_label);
+            write_goto(cond_false_label);
+            write_label(cond_true_label);
+        }
+
+        if (!compile_block(true)) return false;
 
-            if (t->peek() != "{") return false;
+        if (t->peek() == "else") {
             t->advance();
 
             write_goto(end_label);
 
             write_label(cond_false_label);
 
-            if (!compile_statements()) return false;
-
-            if (t->peek() != "}") return false;
-            t->advance();
+            if (!compile_block(true)) return false;
 
             write_label(end_label);
         } else {
@@ -379,51 +553,200 @@ private:
         return true;
     }
 
+    // Compiles a block of statements; a block that can never run is only
+    // checked, not written.
+    bool compile_block(bool reachable) {
+        if (!expect("{")) return false;
+
+        bool was_writing = writing_enabled;
+        writing_enabled = writing_enabled && reachable;
+        bool result = compile_statements();
+        writing_enabled = was_writing && error_count == 0;
+        if (!result) return false;
+
+        if (!expect("}")) return false;
+
+        return true;
+    }
+
+    // whether the then arm of the if statement at the current token is
+    // followed by an else arm
+    bool has_else_arm() {
+        t->save_state();
+        int depth = 0;
+        do {
+            if (t->at_end()) break;
+            string token = t->advance();
+            if (token == "\"") {
+                // skip the string constant and its closing quote
+                t->advance();
+                t->advance();
+            } else if (token == "{") {
+                depth++;
+            } else if (token == "}") {
+                depth--;
+            }
+        } while (depth > 0);
+        bool result = t->peek() == "else";
+        t->restore_state();
+        return result;
+    }
+
     bool compile_while_statement() {
         
         int label_count = while_label_count++;
         string cond_label = "WHILE_EXP";
         cond_label.append(to_string(label_count));
+        size_t loop_start = writing_enabled ? vm_class.functions.back().body.size() : 0;
         write_label(cond_label);
 
-        if (t->peek() != "while") return false;
-        t->advance();
+        if (!expect("while")) return false;
 
-        if (t->peek() != "(") return false;
-        t->advance();
+        if (!expect("(")) return false;
 
-        if (!compile_expression()) return false;
+        size_t condition_start = writing_enabled ? vm_class.functions.back().body.size() : 0;
+        int constant_value;
+        if (!compile_condition(constant_value)) return false;
 
-        if (t->peek() != ")") return false;
-        t->advance();
+        if (!expect(")")) return false;
+
+        double true_probability = -1;
+        if (profile != nullptr && writing_enabled && constant_value == -1) {
+            true_probability = profile->while_true_probability(vm_class.functions.back().name, label_count);
+        }
+
+        if (true_probability >= 0.5 && is_boolean(condition_start)) {
+            // likely to run at least once per entry: the test moves behind
+            // the body and jumps back to it, so a round takes one jump
+            // instead of two
+            string body_label = "WHILE_BODY";
+            body_label.append(to_string(label_count));
+            vector<VmInstruction>& body = vm_class.functions.back().body;
+            vector<VmInstruction> test(body.begin() + loop_start, body.end());
+            body.resize(loop_start);
+
+            write_goto(cond_label);
+            write_label(body_label);
+            if (!compile_block(true)) return false;
+            vm_class.functions.back().body.insert(vm_class.functions.back().body.end(), test.begin(), test.end());
+            write_if(body_label);
+            return true;
+        }
 
-        write("not");
         string end_label = "WHILE_END";
         end_label.append(to_string(label_count));
-        write_if(end_label);
+        if (constant_value == -1) {
+            write_if_false(end_label);
+        }
 
-        if (t->peek() != "{") return false;
-        t->advance();
+        if (!compile_block(constant_value != 0)) return false;
 
-        if (!compile_statements()) return false;
+        if (constant_value != 0) {
+            write_goto(cond_label);
+            write_label(end_label);
+        }
+        
+        return true;
+    }
 
-        if (t->peek() != "}") return false;
-        t->advance();
+    // Compiles the condition of an if or while statement. Pairs of not are
+    // dropped, and a condition that is a constant is not written at all; its
+    // value is returned in constant_value (1 true, 0 false, -1 not constant).
+    bool compile_condition(int& constant_value) {
+        constant_value = -1;
+        size_t start = writing_enabled ? vm_class.functions.back().body.size() : 0;
+        if (!compile_expression()) return false;
+        if (!writing_enabled) return true;
 
-        write_goto(cond_label);
-        write_label(end_label);
-        
+        vector<VmInstruction>& body = vm_class.functions.back().body;
+        while (body.size() >= start + 2 && body.back().op == VmOp::NOT && body[body.size() - 2].op == VmOp::NOT) {
+            body.resize(body.size() - 2);
+        }
+
+        size_t length = body.size() - start;
+        const VmInstruction& first = body[start];
+        if (length == 1 && first.op == VmOp::PUSH && first.segment == Segment::CONSTANT) {
+            constant_value = first.index != 0 ? 1 : 0;
+        } else if (length == 2 && first.op == VmOp::PUSH && first.segment == Segment::CONSTANT && body.back().op == VmOp::NOT) {
+            // true, or ~k of another constant, which is never 0
+            constant_value = 1;
+        }
+        if (constant_value >= 0) {
+            body.resize(start);
+        }
         return true;
     }
 
+    // Jumps to label if the condition on the stack is false, i.e. not -1 as
+    // the while statement has always treated it. A trailing not is taken off
+    // instead of adding a second one.
+    void write_if_false(string label) {
+        if (!writing_enabled) return;
+
+        vector<VmInstruction>& body = vm_class.functions.back().body;
+        if (!body.empty() && body.back().op == VmOp::NOT) {
+            body.pop_back();
+        } else {
+            write("not");
+        }
+        write_if(label);
+    }
+
+    // Whether the code from body[start] on leaves a boolean (0 or -1) on the
+    // stack, so that jumping if it is not -1 is the same as jumping if it is 0.
+    bool is_boolean(size_t start) {
+        const vector<VmInstruction>& body = vm_class.functions.back().body;
+        vector<bool> stack;
+        for (size_t i = start; i < body.size(); i++) {
+            const VmInstruction& instruction = body[i];
+            switch (instruction.op) {
+                case VmOp::PUSH:
+                    stack.push_back(instruction.is(VmOp::PUSH, Segment::CONSTANT, 0));
+                    break;
+                case VmOp::POP:
+                    if (stack.empty()) return false;
+                    stack.pop_back();
+                    break;
+                case VmOp::EQ:
+                case VmOp::GT:
+                case VmOp::LT:
+                case VmOp::ADD:
+                case VmOp::SUB:
+                case VmOp::AND:
+                case VmOp::OR: {
+                    if (stack.size() < 2) return false;
+                    bool both = stack[stack.size() - 1] && stack[stack.size() - 2];
+                    stack.pop_back();
+                    bool is_logical = instruction.op == VmOp::AND || instruction.op == VmOp::OR;
+                    bool is_comparison = instruction.op == VmOp::EQ || instruction.op == VmOp::GT || instruction.op == VmOp::LT;
+                    stack.back() = is_comparison || (is_logical && both);
+                    break;
+                }
+                case VmOp::NEG:
+                    if (stack.empty()) return false;
+                    stack.back() = false;
+                    break;
+                case VmOp::NOT:
+                    if (stack.empty()) return false;
+                    break;
+                case VmOp::CALL:
+                    if ((int)stack.size() < instruction.index) return false;
+                    stack.resize(stack.size() - instruction.index);
+                    stack.push_back(false);
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return stack.size() == 1 && stack.back();
+    }
+
     bool compile_do_statement() {
-        if (t->peek() != "do") return false;
-        t->advance();
+        if (!expect("do")) return false;
 
         if (!compile_subroutine_call()) return false;
 
-        if (t->peek() != ";") return false;
-        t->advance();
+        if (!expect(";")) return false;
 
         write_pop("temp", "0");
 
@@ -431,8 +754,7 @@ private:
     }
 
     bool compile_return_statement() {
-        if (t->peek() != "return") return false;
-        t->advance();
+        if (!expect("return")) return false;
 
         if (t->peek() != ";") {
             if (!compile_expression()) return false;
@@ -440,25 +762,23 @@ private:
             write_push("constant", "0");
         }
 
-        if (t->peek() != ";") return false;
-        t->advance();
+        if (!expect(";")) return false;
 
         write_return();
         
         return true;
     }
 
-    bool compile_expression_list() {
-        if (is_expression()) {
+    bool compile_expression_list(int& n_args) {
+        if (t->peek() != ")") {
             if (!compile_expression()) return false;
-            n_args_count++;
+            n_args++;
 
             while (t->peek() == ",") {
-                if (t->peek() != ",") return false;
-                t->advance();
+                if (!expect(",")) return false;
 
                 if (!compile_expression()) return false;
-                n_args_count++;
+                n_args++;
             }
         }
         
@@ -468,7 +788,7 @@ private:
     bool compile_expression() {
         if (!compile_term()) return false;
 
-        while (regex_match(t->peek(), OP)) {
+        while (is_op(t->peek())) {
             string op = t->peek();
             if (!compile_op()) return false;
 
@@ -481,22 +801,30 @@ private:
     }
 
     bool compile_term() {
-        if (regex_match(t->peek(), INTEGER_CONSTANT)) {
+        if (too_deep("expressions")) return false;
+        NestingLevel level(nesting_depth);
+
+        if (is_integer_constant(t->peek())) {
             string integer_constant = t->peek();
+            if (stoi(integer_constant) > MAX_INTEGER_CONSTANT) {
+                error("integer constant " + integer_constant + " is larger than " + to_string(MAX_INTEGER_CONSTANT));
+            }
             t->advance();
 
             write_push("constant", integer_constant);
         } else if (t->peek() == "\"") {
             t->advance();
             string str_constant = t->peek();
-            if (!(regex_match(str_constant, STRING_CONSTANT))) return false;
+            if (!is_string_constant(str_constant)) {
+                error("invalid string constant");
+                return false;
+            }
 
             write_string(str_constant);
             t->advance();
 
-            if (t->peek() != "\"") return false;
-            t->advance();
-        } else if (regex_match(t->peek(), KEYWORD_CONSTANT)) {
+            if (!expect("\"")) return false;
+        } else if (is_keyword_constant(t->peek())) {
             string keyword = t->peek();
             t->advance();
 
@@ -510,21 +838,22 @@ private:
             } else if (keyword == "this") {
                 write_push("pointer", "0");
             } else {
-                cout << "Keyword constant '" << keyword << "' not recognized. Expected 'true', 'false', 'null' or 'this'." << endl;
+                LOG_ERROR("Keyword constant '" << keyword << "' not recognized. Expected 'true', 'false', 'null' or 'this'.");
             }
-        } else if (regex_match(t->peek(), UNARY_OP)) {
+        } else if (is_unary_op(t->peek())) {
             string op = t->peek();
             t->advance();
             if (!compile_term()) return false;
             write_unary_op(op);
         } else if (t->peek() == "(") {
-            if (t->peek() != "(") return false;
-            t->advance();
+            if (!expect("(")) return false;
 
             if (!compile_expression()) return false;
 
-            if (t->peek() != ")") return false;
-            t->advance();
+            if (!expect(")")) return false;
+        } else if (t->at_end() || !is_identifier(t->peek())) {
+            error("expected an expression, found " + found());
+            return false;
         } else {
             if (t->look_ahead(1) == "(" || t->look_ahead(1) == ".") {
                 if (!compile_subroutine_call()) return false;
@@ -545,21 +874,23 @@ private:
                     segment = KIND_TO_SEGMENT.at(var_kind);
                     write_push(segment, var_index);
                 } else {
-                    cout << "Identifier '" << var_name << "' not recognized." << endl;
+                    error("unknown identifier '" + var_name + "'");
                 }
 
                 if (t->peek() == "[") {
-                    if (t->peek() != "[") return false;
-                    t->advance();
+                    if (!expect("[")) return false;
 
+                    size_t index_start = current_size();
                     if (!compile_expression()) return false;
 
-                    if (t->peek() != "]") return false;
-                    t->advance();
+                    if (!expect("]")) return false;
 
-                    write("add");
+                    int offset = 0;
+                    if (!take_constant_index(index_start, offset)) {
+                        write("add");
+                    }
                     write_pop("pointer", "1");
-                    write_push("that", "0");
+                    write_push("that", to_string(offset));
                 }
             }
         }
@@ -568,7 +899,7 @@ private:
     }
 
     bool compile_op() {
-        if (!(regex_match(t->peek(), OP))) return false;
+        if (!is_op(t->peek())) return false;
         t->advance();
 
         return true;
@@ -576,55 +907,59 @@ private:
 
     bool compile_subroutine_call() {
         bool is_method = false;
-        bool is_other_method_local = false;
-        bool is_other_method_field = false;
+        bool is_other_method = false;
 
+        CallSite call = {"", "", 0, true, t->file(), t->line(), t->column()};
         string subroutine_name = t->peek();
         if (!compile_identifier()) return false;
+        string segment;
         string index;
 
         if (t->peek() == ".") {
-            if (t->peek() != ".") return false;
-            t->advance();
+            if (!expect(".")) return false;
 
             if (subroutine_table.contains(subroutine_name)) {
+                segment = KIND_TO_SEGMENT.at(subroutine_table.kind_of(subroutine_name));
                 index = to_string(subroutine_table.index_of(subroutine_name));
                 subroutine_name = subroutine_table.type_of(subroutine_name);
-                is_other_method_local = true;
+                is_other_method = true;
             } else if (class_table.contains(subroutine_name)) {
+                segment = KIND_TO_SEGMENT.at(class_table.kind_of(subroutine_name));
                 index = to_string(class_table.index_of(subroutine_name));
                 subroutine_name = class_table.type_of(subroutine_name);
-                is_other_method_field = true;
+                is_other_method = true;
             }
             
+            call.class_name = subroutine_name;
+            call.subroutine = t->peek();
+            call.is_method_call = is_other_method;
             subroutine_name.append(".").append(t->peek());
             if (!compile_identifier()) return false;
         } else {
+            call.class_name = class_name;
+            call.subroutine = subroutine_name;
             subroutine_name = class_name + "." + subroutine_name;
             is_method = true;
         }
 
-        n_args_count = 0;
+        int n_args = 0;
         if (is_method) {
             write_push("pointer", "0");
-            n_args_count++;
-        } else if (is_other_method_local) {
-            write_push("local", index); // todo
-            n_args_count++;
-        } else if (is_other_method_field) {
-            write_push("this", index); // todo
-            n_args_count++;
+            n_args++;
+        } else if (is_other_method) {
+            write_push(segment, index);
+            n_args++;
         }
 
-        if (t->peek() != "(") return false;
-        t->advance();
+        if (!expect("(")) return false;
 
-        if (!compile_expression_list()) return false;
+        if (!compile_expression_list(n_args)) return false;
 
-        if (t->peek() != ")") return false;
-        t->advance();
+        if (!expect(")")) return false;
 
-        write_call(subroutine_name, n_args_count);
+        call.n_args = n_args - (call.is_method_call ? 1 : 0);
+        calls.push_back(call);
+        write_call(subroutine_name, n_args);
 
         return true;
     }
@@ -656,15 +991,15 @@ private:
             subroutine_table.define(name, type, kind);
         }
 
-        if (t->peek() != ";") return false;
-        t->advance();
+        if (!expect(";")) return false;
 
         
         return true;
     }
 
     bool compile_identifier() {
-        if (!regex_match(t->peek(), IDENTIFIER)) {
+        if (t->at_end() || !is_identifier(t->peek())) {
+            error("expected an identifier, found " + found());
             return false;
         }
 
@@ -683,57 +1018,129 @@ private:
             return true;
         }
 
-        if (!compile_identifier()) return false;
+        if (t->at_end() || !is_identifier(t->peek())) {
+            error("expected a type, found " + found());
+            return false;
+        }
+        t->advance();
 
         return true;
     }
 
-    bool is_expression() {
-        t->save_state();
+    // Consumes the expected token, or reports what was found instead.
+    bool expect(const string& token) {
+        if (t->at_end() || t->peek() != token) {
+            error("expected '" + token + "', found " + found());
+            return false;
+        }
+        t->advance();
+        return true;
+    }
+
+    string found() {
+        return t->at_end() ? "end of file" : "'" + t->peek() + "'";
+    }
+
+    // Reports an error at the current token. No more code is written after
+    // an error.
+    void error(const string& message) {
+        t->error(message);
+        error_count++;
         writing_enabled = false;
+    }
 
-        if (!compile_expression()) {
-            t->restore_state();
-            writing_enabled = true;
-            return false;
+    static bool is_subroutine_keyword(const string& token) {
+        return token == "constructor" || token == "function" || token == "method";
+    }
+
+    static bool is_declaration_keyword(const string& token) {
+        return is_subroutine_keyword(token) || token == "static" || token == "field";
+    }
+
+    static bool is_statement_keyword(const string& token) {
+        return token == "let" || token == "if" || token == "while" || token == "do" || token == "return";
+    }
+
+    // Skips a token, and the rest of a string constant if it is an opening
+    // quote. Returns the skipped token.
+    string skip_token() {
+        string token = t->advance();
+        if (token == "\"") {
+            t->advance();
+            t->advance();
         }
+        return token;
+    }
 
-        t->restore_state();
-        writing_enabled = true;
-        return true;
+    // Recovers from a syntax error in the statement that started at start:
+    // skips past the next ';', or up to the next statement keyword or the
+    // '}' that closes the block, jumping over nested blocks.
+    void skip_statement(size_t start) {
+        if (t->position() == start && !t->at_end() && t->peek() != "}") skip_token();
+        int depth = 0;
+        while (!t->at_end()) {
+            string token = t->peek();
+            bool at_boundary = is_statement_keyword(token) || is_declaration_keyword(token) || token == "}" || token == "var";
+            if (depth == 0 && at_boundary) return;
+            skip_token();
+            if (token == "{") {
+                depth++;
+            } else if (token == "}") {
+                depth--;
+            } else if (token == ";" && depth == 0) {
+                return;
+            }
+        }
+    }
+
+    // Recovers from a syntax error in the declaration that started at start
+    // by skipping to the next class variable or subroutine declaration.
+    void skip_declaration(size_t start) {
+        if (t->position() == start && !t->at_end()) skip_token();
+        while (!t->at_end() && !is_declaration_keyword(t->peek())) {
+            skip_token();
+        }
     }
 
 
     // WRITE VM CODE
 
-    void write_function(string name, int n_locals) {
+    void write_function(string name, int n_locals, int n_args) {
         if (writing_enabled) {
-            output << "function " << class_name << '.' << name << " " << to_string(n_locals) << '\n';
+            vm_class.functions.push_back({class_name + "." + name, n_locals, n_args, {}});
         }
     }
 
     void write_push(string segment, string index) {
         if (writing_enabled) {
-            output << "push " << segment << " " << index << '\n';
+            if (SEGMENTS.find(segment) != SEGMENTS.end()) {
+                emit(VmInstruction::push(SEGMENTS.at(segment), stoi(index)));
+            } else {
+                LOG_ERROR("Segment '" << segment << "' not recognized.");
+            }
         }
     }
 
     void write_pop(string segment, string index) {
         if (writing_enabled) {
-            output << "pop " << segment << " " << index << '\n';
+            if (SEGMENTS.find(segment) != SEGMENTS.end()) {
+                emit(VmInstruction::pop(SEGMENTS.at(segment), stoi(index)));
+            } else {
+                LOG_ERROR("Segment '" << segment << "' not recognized.");
+            }
         }
     }
 
     void write_op(string op) {
         if (writing_enabled) {
             if (OP_TO_VM.find(op) != OP_TO_VM.end()) {
-                output << OP_TO_VM.at(op) << '\n';
+                write(OP_TO_VM.at(op));
             } else if (op == "*") {
                 write_call("Math.multiply", 2);
             } else if (op == "/") {
                 write_call("Math.divide", 2);
             } else {
-                cout << "Operation '" << op << "' not recognized." << endl;
+                LOG_ERROR("Operation '" << op << "' not recognized.");
             }
         }
     }
@@ -741,47 +1148,49 @@ private:
     void write_unary_op(string op) {
         if (writing_enabled) {
             if (UNARY_OP_TO_VM.find(op) != UNARY_OP_TO_VM.end()) {
-                output << UNARY_OP_TO_VM.at(op) << '\n';
+                write(UNARY_OP_TO_VM.at(op));
             } else {
-                cout << "Unary operation '" << op << "' not recognized." << endl;
+                LOG_ERROR("Unary operation '" << op << "' not recognized.");
             }
         }
     }
 
     void write_call(string name, int n_args) {
         if (writing_enabled) {
-            output << "call " << name << " " << to_string(n_args) << '\n';
+            emit(VmInstruction::call(name, n_args));
         }
     }
 
     void write_return() {
         if (writing_enabled) {
-            output << "return" << "\n";
+            emit(VmInstruction::ret());
         }
     }
 
     void write_label(string label) {
         if (writing_enabled) {
-            output << "label " << label << endl;
+            emit(VmInstruction::label(label));
         }
     }
 
     void write_if(string label) {
         if (writing_enabled) {
-            output << "if-goto " << label << endl;
+            emit(VmInstruction::jump(VmOp::IF_GOTO, label));
         }
     }
 
     void write_goto(string label) {
         if (writing_enabled) {
-            output << "goto " << label << endl;
+            emit(VmInstruction::jump(VmOp::GOTO, label));
         }
     }
 
     void write_string(string string_constant) {
         if (writing_enabled) {
             write_push("constant", to_string(string_constant.length()));
-            write_call("String.new", 1);
+            VmInstruction string_new = VmInstruction::call("String.new", 1);
+            string_new.literal = true;
+            emit(string_new);
             for (char c : string_constant) {
                 write_push("constant", to_string(static_cast<int>(c)));
                 write_call("String.appendChar", 2);
@@ -791,10 +1200,18 @@ private:
 
     void write(string command) {
         if (writing_enabled) {
-            output << command << '\n';
+            if (ARITHMETIC_OPS.find(command) != ARITHMETIC_OPS.end()) {
+                emit(VmInstruction::arithmetic(ARITHMETIC_OPS.at(command)));
+            } else {
+                LOG_ERROR("Command '" << command << "' not recognized.");
+            }
         }
     }
 
+    void emit(VmInstruction instruction) {
+        vm_class.functions.back().body.push_back(instruction);
+    }
+
 };
 
 #endif // COMPILER_CPP
\ No newline at end of file
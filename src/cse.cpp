@@ -0,0 +1,414 @@
+#ifndef CSE_CPP
+#define CSE_CPP
+
+#include "vm_code.cpp"
+#include "cfg.cpp"
+#include "hack_backend.cpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+// OS functions whose result only depends on their arguments. Math.divide is
+// left out because it reports division by zero.
+static const unordered_set<string> PURE_FUNCTIONS = {
+    "Math.multiply",
+    "Math.abs",
+    "Math.min",
+    "Math.max",
+};
+
+// Whether a call is to one of the pure OS functions. A class the program
+// defines itself replaces the OS one, and its subroutines may do anything.
+bool is_pure_call(const VmInstruction& instruction, const unordered_set<string>& program_classes) {
+    return PURE_FUNCTIONS.count(instruction.name) > 0 && program_classes.count(class_of(instruction.name)) == 0;
+}
+
+// Hack cycles a pure function is assumed to take on top of the call itself.
+static const int PURE_CALL_CYCLES = 100;
+
+// A value computed by the commands [start, end) of a block. Expressions with
+// the same key compute the same value as long as nothing in reads changes in
+// between. reads holds slots such as "local 2", the categories "static" and
+// "temp" of static and temp slots, "pointer 0"/"pointer 1" and "memory" for
+// anything read through this or that.
+struct Expression {
+    size_t start;
+    size_t end;
+    string key;
+    bool pure;
+    unordered_set<string> reads;
+};
+
+// Longer expressions are not reused: they hardly ever repeat, and building
+// their keys would take time and memory growing with the square of their
+// length.
+static const size_t MAX_EXPRESSION_COMMANDS = 64;
+
+void limit_length(Expression& expression, size_t i) {
+    if (expression.end - expression.start <= MAX_EXPRESSION_COMMANDS) return;
+    expression.pure = false;
+    expression.key = "?" + to_string(i);
+}
+
+// The values that are reused or invariant are pure expressions of more than
+// one command: operations, pure calls and array reads
+// (address; pop pointer 1; push that k).
+vector<Expression> find_expressions(const vector<VmInstruction>& body, const unordered_set<string>& program_classes) {
+    vector<Expression> stack;
+    vector<Expression> found;
+    for (size_t i = 0; i < body.size(); i++) {
+        const VmInstruction& instruction = body[i];
+        switch (instruction.op) {
+            case VmOp::PUSH: {
+                string slot = SEGMENT_NAMES[static_cast<int>(instruction.segment)] + " " + to_string(instruction.index);
+                Expression value{i, i + 1, slot, true, {}};
+                switch (instruction.segment) {
+                    case Segment::CONSTANT:
+                        break;
+                    case Segment::STATIC:
+                        value.reads = {slot, "static"};
+                        break;
+                    case Segment::TEMP:
+                        value.reads = {slot, "temp"};
+                        break;
+                    case Segment::THIS:
+                        value.reads = {"memory", "pointer 0"};
+                        break;
+                    case Segment::THAT:
+                        // depends on whichever array access set pointer 1
+                        value.pure = false;
+                        break;
+                    default:
+                        value.reads = {slot};
+                        break;
+                }
+                stack.push_back(value);
+                break;
+            }
+            case VmOp::POP: {
+                if (stack.empty()) break;
+                Expression address = stack.back();
+                stack.pop_back();
+                bool is_array_read = instruction.is(VmOp::POP, Segment::POINTER, 1) && i + 1 < body.size() &&
+                    body[i + 1].op == VmOp::PUSH && body[i + 1].segment == Segment::THAT;
+                if (is_array_read) {
+                    Expression value{address.start, i + 2, "[" + address.key + " + " + to_string(body[i + 1].index) + "]", address.pure, address.reads};
+                    value.reads.insert("memory");
+                    limit_length(value, i);
+                    stack.push_back(value);
+                    found.push_back(value);
+                    i++;
+                }
+                break;
+            }
+            case VmOp::ADD:
+            case VmOp::SUB:
+            case VmOp::EQ:
+            case VmOp::GT:
+            case VmOp::LT:
+            case VmOp::AND:
+            case VmOp::OR: {
+                if (stack.size() < 2) {
+                    stack.clear();
+                    break;
+                }
+                Expression right = stack.back();
+                stack.pop_back();
+                Expression& left = stack.back();
+                left.end = i + 1;
+                bool is_commutative = instruction.op == VmOp::ADD || instruction.op == VmOp::EQ || instruction.op == VmOp::AND || instruction.op == VmOp::OR;
+                string first = left.key;
+                string second = right.key;
+                if (is_commutative && second < first) swap(first, second);
+                left.key = "(" + first + " " + VM_OP_NAMES[static_cast<int>(instruction.op)] + " " + second + ")";
+                left.pure = left.pure && right.pure;
+                left.reads.insert(right.reads.begin(), right.reads.end());
+                limit_length(left, i);
+                found.push_back(left);
+                break;
+            }
+            case VmOp::NEG:
+            case VmOp::NOT: {
+                if (stack.empty()) break;
+                Expression& operand = stack.back();
+                operand.end = i + 1;
+                operand.key = "(" + VM_OP_NAMES[static_cast<int>(instruction.op)] + " " + operand.key + ")";
+                limit_length(operand, i);
+                found.push_back(operand);
+                break;
+            }
+            case VmOp::CALL: {
+                size_t n_args = instruction.index;
+                Expression value{i, i + 1, "", is_pure_call(instruction, program_classes), {}};
+                if (stack.size() < n_args) {
+                    stack.clear();
+                    value.pure = false;
+                } else {
+                    if (n_args > 0) value.start = stack[stack.size() - n_args].start;
+                    value.key = instruction.name + "(";
+                    for (size_t j = stack.size() - n_args; j < stack.size(); j++) {
+                        value.key += (j > stack.size() - n_args ? ", " : "") + stack[j].key;
+                        value.pure = value.pure && stack[j].pure;
+                        value.reads.insert(stack[j].reads.begin(), stack[j].reads.end());
+                    }
+                    value.key += ")";
+                    stack.resize(stack.size() - n_args);
+                }
+                limit_length(value, i);
+                if (value.pure) {
+                    found.push_back(value);
+                } else {
+                    value.key = "?" + to_string(i);
+                }
+                stack.push_back(value);
+                break;
+            }
+            case VmOp::IF_GOTO:
+                if (!stack.empty()) stack.pop_back();
+                break;
+            default:
+                stack.clear();
+                break;
+        }
+    }
+    return found;
+}
+
+// What a command may change, in the terms of Expression::reads.
+unordered_set<string> kills_of(const VmInstruction& instruction, const unordered_set<string>& program_classes) {
+    if (instruction.op == VmOp::CALL) {
+        if (is_pure_call(instruction, program_classes)) return {};
+        return {"memory", "static", "temp"};
+    }
+    if (instruction.op != VmOp::POP) return {};
+    switch (instruction.segment) {
+        case Segment::THIS:
+        case Segment::THAT:
+            return {"memory"};
+        default:
+            return {SEGMENT_NAMES[static_cast<int>(instruction.segment)] + " " + to_string(instruction.index)};
+    }
+}
+
+bool is_killed(const Expression& expression, const unordered_set<string>& kills) {
+    for (const auto& kill : kills) {
+        if (expression.reads.count(kill) > 0) return true;
+    }
+    return false;
+}
+
+// Optimizations that replace an expression with a cached copy of its value.
+// The copy lives in a new local slot; reuse_local_slots packs them later.
+class ExpressionCache
+{
+public:
+    // program_classes are the classes compiled from the program, see
+    // defined_classes.
+    ExpressionCache(VmFunction& function, const unordered_set<string>& program_classes) : backend(false, false) {
+        this->function = &function;
+        this->program_classes = &program_classes;
+        push_cost = backend.estimate_cycles(VmInstruction::push(Segment::LOCAL, 0));
+        pop_cost = backend.estimate_cycles(VmInstruction::pop(Segment::LOCAL, 0));
+    }
+
+    // Local common subexpression elimination: the first of several equal
+    // expressions in a block stores its value, the others push it. Returns
+    // the number of expressions replaced.
+    int eliminate_common_subexpressions() {
+        ControlFlowGraph graph(function->body);
+        int replaced = 0;
+        for (auto& block : graph.blocks) {
+            int count;
+            while ((count = eliminate_best(block.body)) > 0) {
+                replaced += count;
+            }
+        }
+        function->body = graph.to_instructions();
+        return replaced;
+    }
+
+    // Moves pure expressions that do not change inside a while loop in front
+    // of the loop. Loops are the blocks from a label to the goto or if-goto
+    // back to it, with no way in but from the block before them. Returns the
+    // number of expressions hoisted.
+    int hoist_loop_invariants() {
+        ControlFlowGraph graph(function->body);
+        vector<pair<int, int>> loops;
+        for (int block = 0; block < (int)graph.blocks.size(); block++) {
+            const VmInstruction* last = graph.blocks[block].terminator();
+            if (last == nullptr || !last->is_jump()) continue;
+            int header = graph.block_of(last->name);
+            if (header > 0 && header <= block) loops.push_back({header, block});
+        }
+        // inner loops first, so what they hoist can move further out
+        sort(loops.begin(), loops.end(), [](const pair<int, int>& a, const pair<int, int>& b) {
+            return a.second - a.first < b.second - b.first;
+        });
+
+        int hoisted = 0;
+        for (const auto& loop : loops) {
+            if (has_single_entry(graph, loop.first, loop.second)) {
+                hoisted += hoist(graph, loop.first, loop.second);
+            }
+        }
+        function->body = graph.to_instructions();
+        return hoisted;
+    }
+
+private:
+    VmFunction* function;
+    const unordered_set<string>* program_classes;
+    HackBackend backend;
+    int push_cost;
+    int pop_cost;
+
+    int cost(const vector<VmInstruction>& body, const Expression& expression) {
+        int cycles = 0;
+        for (size_t i = expression.start; i < expression.end; i++) {
+            cycles += backend.estimate_cycles(body[i]);
+            if (body[i].op == VmOp::CALL) cycles += PURE_CALL_CYCLES;
+        }
+        return cycles;
+    }
+
+    // Replacing body[start, end) with a push of its value loses the pointer 1
+    // it set; that is only safe if the block sets it again before using it.
+    static bool can_replace(const vector<VmInstruction>& body, const Expression& expression) {
+        bool sets_that = false;
+        for (size_t i = expression.start; i < expression.end; i++) {
+            if (body[i].is(VmOp::POP, Segment::POINTER, 1)) sets_that = true;
+        }
+        if (!sets_that) return true;
+        for (size_t i = expression.end; i < body.size(); i++) {
+            if (body[i].is(VmOp::POP, Segment::POINTER, 1)) return true;
+            if (body[i].segment == Segment::THAT || body[i].is(VmOp::PUSH, Segment::POINTER, 1)) return false;
+        }
+        return true;
+    }
+
+    bool is_unchanged_between(const vector<VmInstruction>& body, const Expression& expression, size_t start, size_t end) {
+        for (size_t i = start; i < end; i++) {
+            if (is_killed(expression, kills_of(body[i], *program_classes))) return false;
+        }
+        return true;
+    }
+
+    int eliminate_best(vector<VmInstruction>& body) {
+        unordered_map<string, vector<Expression>> by_key;
+        for (const auto& expression : find_expressions(body, *program_classes)) {
+            if (expression.pure) by_key[expression.key].push_back(expression);
+        }
+
+        int best_saving = 0;
+        vector<Expression> best;
+        for (auto& entry : by_key) {
+            vector<Expression>& occurrences = entry.second;
+            sort(occurrences.begin(), occurrences.end(), [](const Expression& a, const Expression& b) {
+                return a.start < b.start;
+            });
+
+            vector<Expression> chain = {occurrences.front()};
+            for (size_t i = 1; i < occurrences.size(); i++) {
+                const Expression& occurrence = occurrences[i];
+                if (occurrence.start < chain.back().end) continue;
+                if (!is_unchanged_between(body, chain.front(), chain.front().end, occurrence.start)) break;
+                if (can_replace(body, occurrence)) chain.push_back(occurrence);
+            }
+
+            if (chain.size() < 2) continue;
+            int saving = (chain.size() - 1) * (cost(body, chain.front()) - push_cost) - pop_cost - push_cost;
+            if (saving > best_saving) {
+                best_saving = saving;
+                best = chain;
+            }
+        }
+        if (best.empty()) return 0;
+
+        int slot = function->n_locals++;
+        for (size_t i = best.size() - 1; i > 0; i--) {
+            body.erase(body.begin() + best[i].start, body.begin() + best[i].end);
+            body.insert(body.begin() + best[i].start, VmInstruction::push(Segment::LOCAL, slot));
+        }
+        body.insert(body.begin() + best.front().end, {VmInstruction::pop(Segment::LOCAL, slot), VmInstruction::push(Segment::LOCAL, slot)});
+        return best.size() - 1;
+    }
+
+    // The loop blocks [header, back_edge] are only entered from the block
+    // before them: by falling into the header or, for a loop with its test at
+    // the bottom, by the goto to the test that ends that block.
+    static bool has_single_entry(const ControlFlowGraph& graph, int header, int back_edge) {
+        const VmInstruction* last = graph.blocks[header - 1].terminator();
+        if (last != nullptr && last->op == VmOp::GOTO) {
+            int target = graph.block_of(last->name);
+            if (target < header || target > back_edge) return false;
+        } else if (!graph.blocks[header - 1].falls_through()) {
+            return false;
+        }
+        vector<vector<int>> predecessors = graph.predecessors();
+        for (int block = header; block <= back_edge; block++) {
+            for (int predecessor : predecessors[block]) {
+                bool inside = predecessor >= header && predecessor <= back_edge;
+                bool is_preheader = predecessor == header - 1;
+                if (!inside && !is_preheader) return false;
+            }
+        }
+        return true;
+    }
+
+    int hoist(ControlFlowGraph& graph, int header, int back_edge) {
+        unordered_set<string> kills;
+        for (int block = header; block <= back_edge; block++) {
+            for (const auto& instruction : graph.blocks[block].body) {
+                unordered_set<string> instruction_kills = kills_of(instruction, *program_classes);
+                kills.insert(instruction_kills.begin(), instruction_kills.end());
+            }
+        }
+
+        unordered_map<string, int> slots;
+        vector<VmInstruction> preheader_code;
+        for (int block = header; block <= back_edge; block++) {
+            vector<VmInstruction>& body = graph.blocks[block].body;
+            vector<Expression> invariants;
+            for (const auto& expression : find_expressions(body, *program_classes)) {
+                if (!expression.pure || is_killed(expression, kills)) continue;
+                if (cost(body, expression) <= push_cost || !can_replace(body, expression)) continue;
+                invariants.push_back(expression);
+            }
+            // outermost expressions first, inner ones are hoisted with them
+            sort(invariants.begin(), invariants.end(), [](const Expression& a, const Expression& b) {
+                return a.start != b.start ? a.start < b.start : a.end > b.end;
+            });
+
+            vector<Expression> chosen;
+            for (const auto& expression : invariants) {
+                if (!chosen.empty() && expression.start < chosen.back().end) continue;
+                chosen.push_back(expression);
+            }
+            for (auto expression = chosen.rbegin(); expression != chosen.rend(); expression++) {
+                if (slots.find(expression->key) == slots.end()) {
+                    int slot = function->n_locals++;
+                    slots[expression->key] = slot;
+                    preheader_code.insert(preheader_code.end(), body.begin() + expression->start, body.begin() + expression->end);
+                    preheader_code.push_back(VmInstruction::pop(Segment::LOCAL, slot));
+                }
+                body.erase(body.begin() + expression->start, body.begin() + expression->end);
+                body.insert(body.begin() + expression->start, VmInstruction::push(Segment::LOCAL, slots.at(expression->key)));
+            }
+        }
+
+        // the code leaves the stack as it was, so it can go in front of an
+        // if-goto that ends the block before the loop
+        vector<VmInstruction>& preheader = graph.blocks[header - 1].body;
+        auto position = preheader.end();
+        if (graph.blocks[header - 1].terminator() != nullptr) position--;
+        preheader.insert(position, preheader_code.begin(), preheader_code.end());
+        return slots.size();
+    }
+
+};
+
+#endif // CSE_CPP
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef DIAGNOSTICS_CPP
+#define DIAGNOSTICS_CPP
+
+#include "log.cpp"
+#include <string>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+// Collects the errors found while compiling, with the file, line and column
+// they were found at, and prints them as they come in. In text format they
+// are logged as errors, `file:line:column: error: message`; in JSON format
+// each one is written to stderr as a JSON object on a line of its own:
+//
+//   {"file": "Main.jack", "line": 3, "column": 9, "severity": "error", "message": "..."}
+//
+// After max_errors errors (0 for no limit) limit_reached() is true and
+// further errors are dropped, so the compiler can stop early.
+class Diagnostics
+{
+public:
+    Diagnostics(int max_errors = 0, bool json = false) {
+        this->max_errors = max_errors;
+        this->json = json;
+    }
+
+    void error(const string& file, int line, int column, const string& message) {
+        if (limit_reached()) return;
+        error_count++;
+        if (json) {
+            cerr << "{\"file\": " << quoted_json(file) << ", \"line\": " << line << ", \"column\": " << column
+                 << ", \"severity\": \"error\", \"message\": " << quoted_json(message) << "}" << '\n';
+        } else {
+            LOG_ERROR(file << ':' << line << ':' << column << ": error: " << message);
+        }
+        if (limit_reached() && !json) {
+            LOG_ERROR("Too many errors, stopping.");
+        }
+    }
+
+    int errors() const {
+        return error_count;
+    }
+
+    bool limit_reached() const {
+        return max_errors > 0 && error_count >= max_errors;
+    }
+
+private:
+    int max_errors;
+    bool json;
+    int error_count = 0;
+
+    static string quoted_json(const string& text) {
+        stringstream output;
+        output << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                output << '\\' << c;
+            } else if (c == '\n') {
+                output << "\\n";
+            } else if (c == '\t') {
+                output << "\\t";
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                output << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+            } else {
+                output << c;
+            }
+        }
+        output << '"';
+        return output.str();
+    }
+
+};
+
+#endif // DIAGNOSTICS_CPP
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef HACK_ASSEMBLER_CPP
+#define HACK_ASSEMBLER_CPP
+
+#include "log.cpp"
+#include <string>
+#include <vector>
+#include <bitset>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+static const unordered_map<string, int> PREDEFINED_SYMBOLS = {
+    {"SP", 0},
+    {"LCL", 1},
+    {"ARG", 2},
+    {"THIS", 3},
+    {"THAT", 4},
+    {"R0", 0},
+    {"R1", 1},
+    {"R2", 2},
+    {"R3", 3},
+    {"R4", 4},
+    {"R5", 5},
+    {"R6", 6},
+    {"R7", 7},
+    {"R8", 8},
+    {"R9", 9},
+    {"R10", 10},
+    {"R11", 11},
+    {"R12", 12},
+    {"R13", 13},
+    {"R14", 14},
+    {"R15", 15},
+    {"SCREEN", 16384},
+    {"KBD", 24576},
+};
+
+static const unordered_map<string, string> COMP_BITS = {
+    {"0", "0101010"},
+    {"1", "0111111"},
+    {"-1", "0111010"},
+    {"D", "0001100"},
+    {"A", "0110000"},
+    {"!D", "0001101"},
+    {"!A", "0110001"},
+    {"-D", "0001111"},
+    {"-A", "0110011"},
+    {"D+1", "0011111"},
+    {"A+1", "0110111"},
+    {"D-1", "0001110"},
+    {"A-1", "0110010"},
+    {"D+A", "0000010"},
+    {"D-A", "0010011"},
+    {"A-D", "0000111"},
+    {"D&A", "0000000"},
+    {"D|A", "0010101"},
+    {"M", "1110000"},
+    {"!M", "1110001"},
+    {"-M", "1110011"},
+    {"M+1", "1110111"},
+    {"M-1", "1110010"},
+    {"D+M", "1000010"},
+    {"D-M", "1010011"},
+    {"M-D", "1000111"},
+    {"D&M", "1000000"},
+    {"D|M", "1010101"},
+};
+
+static const unordered_map<string, string> JUMP_BITS = {
+    {"", "000"},
+    {"JGT", "001"},
+    {"JEQ", "010"},
+    {"JGE", "011"},
+    {"JLT", "100"},
+    {"JNE", "101"},
+    {"JLE", "110"},
+    {"JMP", "111"},
+};
+
+// Translates Hack assembly into the textual .hack format (one 16 bit binary
+// word per line). Variables are allocated from RAM[16] upwards.
+class HackAssembler
+{
+public:
+    bool assemble(const vector<string>& lines, vector<string>& binary) {
+        unordered_map<string, int> symbols = PREDEFINED_SYMBOLS;
+
+        int address = 0;
+        for (const auto& line : lines) {
+            if (line.front() == '(') {
+                symbols[line.substr(1, line.length() - 2)] = address;
+            } else {
+                address++;
+            }
+        }
+
+        int next_variable = 16;
+        for (const auto& line : lines) {
+            if (line.front() == '(') continue;
+
+            if (line.front() == '@') {
+                string value = line.substr(1);
+                int number;
+                if (isdigit(value.front())) {
+                    number = stoi(value);
+                } else if (symbols.find(value) != symbols.end()) {
+                    number = symbols.at(value);
+                } else {
+                    number = next_variable++;
+                    symbols[value] = number;
+                }
+                binary.push_back(bitset<16>(number & 0x7FFF).to_string());
+                continue;
+            }
+
+            string dest;
+            string comp = line;
+            string jump;
+            auto equals_pos = comp.find('=');
+            if (equals_pos != string::npos) {
+                dest = comp.substr(0, equals_pos);
+                comp = comp.substr(equals_pos + 1);
+            }
+            auto semicolon_pos = comp.find(';');
+            if (semicolon_pos != string::npos) {
+                jump = comp.substr(semicolon_pos + 1);
+                comp = comp.substr(0, semicolon_pos);
+            }
+
+            if (COMP_BITS.find(comp) == COMP_BITS.end() || JUMP_BITS.find(jump) == JUMP_BITS.end()) {
+                LOG_ERROR("Invalid instruction: " << line);
+                return false;
+            }
+            string dest_bits = "000";
+            for (char register_name : dest) {
+                if (register_name == 'A') dest_bits[0] = '1';
+                else if (register_name == 'D') dest_bits[1] = '1';
+                else if (register_name == 'M') dest_bits[2] = '1';
+            }
+            binary.push_back("111" + COMP_BITS.at(comp) + dest_bits + JUMP_BITS.at(jump));
+        }
+        return true;
+    }
+
+};
+
+#endif // HACK_ASSEMBLER_CPP
\ No newline at end of file
@@ -0,0 +1,833 @@
+#ifndef HACK_BACKEND_CPP
+#define HACK_BACKEND_CPP
+
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const string CALL_TRAMPOLINE = "$$CALL";
+static const string RETURN_TRAMPOLINE = "$$RETURN";
+static const string RETURN_D_TRAMPOLINE = "$$RETURN_D";
+
+// Deepest local/argument/this/that slot that the optimizing backend addresses
+// with a chain of A=A+1 instead of computing base + index in D.
+static const int MAX_OFFSET_CHAIN = 4;
+
+static const unordered_map<VmOp, string> COMPARE_TRAMPOLINES = {
+    {VmOp::EQ, "$$EQ"},
+    {VmOp::GT, "$$GT"},
+    {VmOp::LT, "$$LT"},
+};
+
+static const unordered_map<VmOp, string> COMPARE_JUMPS = {
+    {VmOp::EQ, "JEQ"},
+    {VmOp::GT, "JGT"},
+    {VmOp::LT, "JLT"},
+};
+
+static const unordered_map<VmOp, string> INVERTED_COMPARE_JUMPS = {
+    {VmOp::EQ, "JNE"},
+    {VmOp::GT, "JLE"},
+    {VmOp::LT, "JGE"},
+};
+
+static const unordered_map<VmOp, string> FUSED_OPS = {
+    {VmOp::ADD, "D=D+"},
+    {VmOp::SUB, "D=D-"},
+    {VmOp::AND, "D=D&"},
+    {VmOp::OR, "D=D|"},
+    {VmOp::EQ, "D=D-"},
+    {VmOp::GT, "D=D-"},
+    {VmOp::LT, "D=D-"},
+};
+
+static const unordered_map<VmOp, string> CACHED_OPS = {
+    {VmOp::ADD, "D=D+M"},
+    {VmOp::SUB, "D=M-D"},
+    {VmOp::AND, "D=D&M"},
+    {VmOp::OR, "D=D|M"},
+    {VmOp::EQ, "D=M-D"},
+};
+
+static const unordered_map<Segment, string> SEGMENT_POINTERS = {
+    {Segment::LOCAL, "LCL"},
+    {Segment::ARGUMENT, "ARG"},
+    {Segment::THIS, "THIS"},
+    {Segment::THAT, "THAT"},
+};
+
+// Lowers VM code to Hack assembly. The call, return and comparison commands
+// jump to shared trampolines that are written once at the end of the image,
+// so every call site costs a handful of instructions instead of a full frame
+// setup.
+//
+// With optimize set, the top of the stack is kept in the D register between
+// commands instead of in RAM[SP-1], a push followed by an operation uses its
+// operand straight from memory, a comparison followed by if-goto (or by not
+// and if-goto) becomes one conditional jump, and low local/argument slots are
+// addressed with constant offsets. The cached value is written back before labels, jumps and calls.
+class HackBackend
+{
+public:
+    HackBackend(bool bootstrap, bool optimize) {
+        this->bootstrap = bootstrap;
+        this->optimize = optimize;
+    }
+
+    vector<string> translate(const VmProgram& program) {
+        lines.clear();
+        return_count = 0;
+
+        if (bootstrap) {
+            write_bootstrap();
+        }
+        for (const auto& vm_class : program.classes) {
+            class_name = vm_class.name;
+            for (const auto& function : vm_class.functions) {
+                write_function(function);
+            }
+        }
+        write_trampolines();
+
+        return lines;
+    }
+
+    // Hack instructions the plain lowering executes for one VM command,
+    // including the shared trampoline it jumps to. FUNCTION stands for the
+    // function entry, with index holding the local count. The longer path is
+    // counted for comparisons.
+    int estimate_cycles(const VmInstruction& instruction) {
+        vector<string> saved_lines = lines;
+        lines.clear();
+        switch (instruction.op) {
+            case VmOp::FUNCTION:
+                write_function({"", instruction.index, -1, {}});
+                break;
+            case VmOp::CALL:
+                write_instruction(instruction);
+                write_call_trampoline();
+                break;
+            case VmOp::RETURN:
+                write_instruction(instruction);
+                write_return_trampoline();
+                break;
+            case VmOp::EQ:
+            case VmOp::GT:
+            case VmOp::LT:
+                write_instruction(instruction);
+                write_compare_trampoline(instruction.op);
+                break;
+            default:
+                write_instruction(instruction);
+                break;
+        }
+        int cycles = instruction_count(lines);
+        lines = saved_lines;
+        return cycles;
+    }
+
+    // Hack instructions the plain lowering writes at the site of one VM
+    // command, without the shared trampolines.
+    int estimate_size(const VmInstruction& instruction) {
+        vector<string> saved_lines = lines;
+        lines.clear();
+        if (instruction.op == VmOp::FUNCTION) {
+            write_function({"", instruction.index, -1, {}});
+        } else {
+            write_instruction(instruction);
+        }
+        int size = instruction_count(lines);
+        lines = saved_lines;
+        return size;
+    }
+
+    // Hack instructions a function takes in the image, without the shared
+    // trampolines.
+    int function_size(const VmFunction& function) {
+        vector<string> saved_lines = lines;
+        lines.clear();
+        class_name = class_of(function.name);
+        write_function(function);
+        int size = instruction_count(lines);
+        lines = saved_lines;
+        return size;
+    }
+
+    static int instruction_count(const vector<string>& lines) {
+        int count = 0;
+        for (const auto& line : lines) {
+            if (line.front() != '(') count++;
+        }
+        return count;
+    }
+
+private:
+    bool bootstrap;
+    bool optimize;
+    vector<string> lines;
+    string class_name;
+    string function_name;
+    int return_count = 0;
+
+    // optimizing backend state: the top of the stack is in D instead of RAM,
+    // and D holds a copy of pointer d_pointer (-1 if it does not)
+    bool top_in_d = false;
+    int d_pointer = -1;
+
+    void write_bootstrap() {
+        a("256");
+        c("D=A");
+        a("SP");
+        c("M=D");
+        write_call("Sys.init", 0);
+    }
+
+    void write_function(const VmFunction& function) {
+        function_name = function.name;
+        label(function.name);
+        if (function.n_locals > 0) {
+            a("SP");
+            c("A=M");
+            for (int i = 0; i < function.n_locals; i++) {
+                c("M=0");
+                c("A=A+1");
+            }
+            c("D=A");
+            a("SP");
+            c("M=D");
+        }
+
+        if (optimize) {
+            write_optimized_body(function.body);
+            return;
+        }
+        for (size_t i = 0; i < function.body.size(); i++) {
+            const VmInstruction& instruction = function.body[i];
+            bool next_is_if = i + 1 < function.body.size() && function.body[i + 1].op == VmOp::IF_GOTO;
+            if (instruction.op == VmOp::NOT && next_is_if) {
+                // not; if-goto jumps if the value is not -1
+                a("SP");
+                c("AM=M-1");
+                c("D=M+1");
+                a(function_name + "$" + function.body[i + 1].name);
+                c("D;JNE");
+                i++;
+            } else {
+                write_instruction(instruction);
+            }
+        }
+    }
+
+    void write_instruction(const VmInstruction& instruction) {
+        switch (instruction.op) {
+            case VmOp::PUSH:
+                write_push(instruction.segment, instruction.index);
+                break;
+            case VmOp::POP:
+                write_pop(instruction.segment, instruction.index);
+                break;
+            case VmOp::ADD:
+                write_binary("M=D+M");
+                break;
+            case VmOp::SUB:
+                write_binary("M=M-D");
+                break;
+            case VmOp::AND:
+                write_binary("M=D&M");
+                break;
+            case VmOp::OR:
+                write_binary("M=D|M");
+                break;
+            case VmOp::NEG:
+                write_unary("M=-M");
+                break;
+            case VmOp::NOT:
+                write_unary("M=!M");
+                break;
+            case VmOp::EQ:
+            case VmOp::GT:
+            case VmOp::LT:
+                write_compare(instruction.op);
+                break;
+            case VmOp::LABEL:
+                label(function_name + "$" + instruction.name);
+                break;
+            case VmOp::GOTO:
+                a(function_name + "$" + instruction.name);
+                c("0;JMP");
+                break;
+            case VmOp::IF_GOTO:
+                a("SP");
+                c("AM=M-1");
+                c("D=M");
+                a(function_name + "$" + instruction.name);
+                c("D;JNE");
+                break;
+            case VmOp::CALL:
+                write_call(instruction.name, instruction.index);
+                break;
+            case VmOp::RETURN:
+                a(RETURN_TRAMPOLINE);
+                c("0;JMP");
+                break;
+            case VmOp::FUNCTION:
+                break;
+        }
+    }
+
+    // Loads the value of segment[index] into D.
+    void load(Segment segment, int index) {
+        switch (segment) {
+            case Segment::CONSTANT:
+                a(to_string(index));
+                c("D=A");
+                break;
+            case Segment::STATIC:
+                a(class_name + "." + to_string(index));
+                c("D=M");
+                break;
+            case Segment::TEMP:
+                a("R" + to_string(5 + index));
+                c("D=M");
+                break;
+            case Segment::POINTER:
+                a(index == 0 ? "THIS" : "THAT");
+                c("D=M");
+                break;
+            default:
+                address(segment, index);
+                c("D=M");
+                break;
+        }
+    }
+
+    // Points A at segment[index] for the segments that live behind a base pointer.
+    void address(Segment segment, int index) {
+        if (index == 0) {
+            a(SEGMENT_POINTERS.at(segment));
+            c("A=M");
+        } else {
+            a(to_string(index));
+            c("D=A");
+            a(SEGMENT_POINTERS.at(segment));
+            c("A=D+M");
+        }
+    }
+
+    void write_push(Segment segment, int index) {
+        load(segment, index);
+        a("SP");
+        c("AM=M+1");
+        c("A=A-1");
+        c("M=D");
+    }
+
+    void write_pop(Segment segment, int index) {
+        string target;
+        switch (segment) {
+            case Segment::STATIC:
+                target = class_name + "." + to_string(index);
+                break;
+            case Segment::TEMP:
+                target = "R" + to_string(5 + index);
+                break;
+            case Segment::POINTER:
+                target = index == 0 ? "THIS" : "THAT";
+                break;
+            default:
+                break;
+        }
+
+        if (target.empty()) {
+            if (index == 0) {
+                a(SEGMENT_POINTERS.at(segment));
+                c("D=M");
+            } else {
+                a(to_string(index));
+                c("D=A");
+                a(SEGMENT_POINTERS.at(segment));
+                c("D=D+M");
+            }
+            a("R13");
+            c("M=D");
+            a("SP");
+            c("AM=M-1");
+            c("D=M");
+            a("R13");
+            c("A=M");
+            c("M=D");
+        } else {
+            a("SP");
+            c("AM=M-1");
+            c("D=M");
+            a(target);
+            c("M=D");
+        }
+    }
+
+    void write_binary(string computation) {
+        a("SP");
+        c("AM=M-1");
+        c("D=M");
+        c("A=A-1");
+        c(computation);
+    }
+
+    void write_unary(string computation) {
+        a("SP");
+        c("A=M-1");
+        c(computation);
+    }
+
+    void write_compare(VmOp op) {
+        string return_label = next_return_label();
+        a(return_label);
+        c("D=A");
+        a(COMPARE_TRAMPOLINES.at(op));
+        c("0;JMP");
+        label(return_label);
+    }
+
+    void write_call(string name, int n_args) {
+        string return_label = next_return_label();
+        a(to_string(n_args));
+        c("D=A");
+        a("R13");
+        c("M=D");
+        a(name);
+        c("D=A");
+        a("R14");
+        c("M=D");
+        a(return_label);
+        c("D=A");
+        a(CALL_TRAMPOLINE);
+        c("0;JMP");
+        label(return_label);
+    }
+
+    // OPTIMIZING BACKEND
+
+    void write_optimized_body(const vector<VmInstruction>& body) {
+        top_in_d = false;
+        d_pointer = -1;
+        for (size_t i = 0; i < body.size(); i++) {
+            const VmInstruction& instruction = body[i];
+            const VmInstruction* next = i + 1 < body.size() ? &body[i + 1] : nullptr;
+            int known_pointer = d_pointer;
+            d_pointer = -1;
+
+            switch (instruction.op) {
+                case VmOp::PUSH:
+                    if (next != nullptr && fuses(instruction, next->op)) {
+                        load_top();
+                        string source = operand(instruction.segment, instruction.index);
+                        c(FUSED_OPS.at(next->op) + source);
+                        i++;
+                        if (next->op == VmOp::EQ || next->op == VmOp::GT || next->op == VmOp::LT) {
+                            i += write_compare(next->op, body, i + 1);
+                        }
+                    } else {
+                        spill_top();
+                        load_cached(instruction.segment, instruction.index, known_pointer);
+                        top_in_d = true;
+                    }
+                    break;
+                case VmOp::POP:
+                    load_top();
+                    store(instruction.segment, instruction.index);
+                    top_in_d = false;
+                    if (instruction.segment == Segment::POINTER) {
+                        d_pointer = instruction.index;
+                    }
+                    break;
+                case VmOp::ADD:
+                case VmOp::SUB:
+                case VmOp::AND:
+                case VmOp::OR:
+                    load_top();
+                    a("SP");
+                    c("AM=M-1");
+                    c(CACHED_OPS.at(instruction.op));
+                    break;
+                case VmOp::EQ:
+                    load_top();
+                    a("SP");
+                    c("AM=M-1");
+                    c(CACHED_OPS.at(instruction.op));
+                    i += write_compare(instruction.op, body, i + 1);
+                    break;
+                case VmOp::GT:
+                case VmOp::LT:
+                    load_top();
+                    a("R14");
+                    c("M=D");
+                    a("SP");
+                    c("AM=M-1");
+                    c("D=M");
+                    a("R13");
+                    c("M=D");
+                    write_ordered_difference(next_return_label(), next_return_label());
+                    i += write_compare(instruction.op, body, i + 1);
+                    break;
+                case VmOp::NEG:
+                    load_top();
+                    c("D=-D");
+                    break;
+                case VmOp::NOT:
+                    load_top();
+                    if (next != nullptr && next->op == VmOp::IF_GOTO) {
+                        // jumps if the value is not -1
+                        c("D=D+1");
+                        a(function_name + "$" + next->name);
+                        c("D;JNE");
+                        top_in_d = false;
+                        i++;
+                    } else {
+                        c("D=!D");
+                    }
+                    break;
+                case VmOp::LABEL:
+                    spill_top();
+                    label(function_name + "$" + instruction.name);
+                    break;
+                case VmOp::GOTO:
+                    spill_top();
+                    a(function_name + "$" + instruction.name);
+                    c("0;JMP");
+                    break;
+                case VmOp::IF_GOTO:
+                    load_top();
+                    a(function_name + "$" + instruction.name);
+                    c("D;JNE");
+                    top_in_d = false;
+                    break;
+                case VmOp::CALL:
+                    spill_top();
+                    write_call(instruction.name, instruction.index);
+                    break;
+                case VmOp::RETURN:
+                    a(top_in_d ? RETURN_D_TRAMPOLINE : RETURN_TRAMPOLINE);
+                    c("0;JMP");
+                    top_in_d = false;
+                    break;
+                case VmOp::FUNCTION:
+                    break;
+            }
+        }
+        spill_top();
+    }
+
+    // Makes sure the top of the stack is in D.
+    void load_top() {
+        if (!top_in_d) {
+            a("SP");
+            c("AM=M-1");
+            c("D=M");
+            top_in_d = true;
+        }
+    }
+
+    // Writes a cached top of the stack back to RAM.
+    void spill_top() {
+        if (top_in_d) {
+            push_d();
+            top_in_d = false;
+        }
+    }
+
+    // Whether push can be fused with the op after it. x - y only gives the
+    // order of x and y when it does not overflow, so gt and lt are fused only
+    // with a push of 0.
+    bool fuses(const VmInstruction& push, VmOp op) {
+        if (FUSED_OPS.find(op) == FUSED_OPS.end() || !in_reach(push.segment, push.index)) return false;
+        if (op == VmOp::GT || op == VmOp::LT) return push.is(VmOp::PUSH, Segment::CONSTANT, 0);
+        return true;
+    }
+
+    // Whether segment[index] can be reached without touching D.
+    bool in_reach(Segment segment, int index) {
+        if (SEGMENT_POINTERS.find(segment) != SEGMENT_POINTERS.end()) {
+            return index <= MAX_OFFSET_CHAIN;
+        }
+        return true;
+    }
+
+    // Selects segment[index] without touching D and returns the register that
+    // holds it ("A" for constants, "M" otherwise).
+    string operand(Segment segment, int index) {
+        switch (segment) {
+            case Segment::CONSTANT:
+                a(to_string(index));
+                return "A";
+            case Segment::STATIC:
+                a(class_name + "." + to_string(index));
+                return "M";
+            case Segment::TEMP:
+                a("R" + to_string(5 + index));
+                return "M";
+            case Segment::POINTER:
+                a(index == 0 ? "THIS" : "THAT");
+                return "M";
+            default:
+                a(SEGMENT_POINTERS.at(segment));
+                c("A=M");
+                for (int i = 0; i < index; i++) {
+                    c("A=A+1");
+                }
+                return "M";
+        }
+    }
+
+    // Loads segment[index] into D; known_pointer is the pointer D already holds.
+    void load_cached(Segment segment, int index, int known_pointer) {
+        if (segment == Segment::CONSTANT && index <= 1) {
+            c("D=" + to_string(index));
+        } else if (segment == Segment::THAT && known_pointer == 1 && index <= MAX_OFFSET_CHAIN) {
+            c("A=D");
+            for (int i = 0; i < index; i++) {
+                c("A=A+1");
+            }
+            c("D=M");
+        } else if (segment == Segment::THIS && known_pointer == 0 && index <= MAX_OFFSET_CHAIN) {
+            c("A=D");
+            for (int i = 0; i < index; i++) {
+                c("A=A+1");
+            }
+            c("D=M");
+        } else if (SEGMENT_POINTERS.find(segment) != SEGMENT_POINTERS.end() && index <= 2) {
+            c("D=" + operand(segment, index));
+        } else {
+            load(segment, index);
+        }
+    }
+
+    // Stores D into segment[index].
+    void store(Segment segment, int index) {
+        if (SEGMENT_POINTERS.find(segment) != SEGMENT_POINTERS.end() && index > MAX_OFFSET_CHAIN) {
+            a("R13");
+            c("M=D");
+            a(to_string(index));
+            c("D=A");
+            a(SEGMENT_POINTERS.at(segment));
+            c("D=D+M");
+            a("R14");
+            c("M=D");
+            a("R13");
+            c("D=M");
+            a("R14");
+            c("A=M");
+            c("M=D");
+        } else {
+            operand(segment, index);
+            c("M=D");
+        }
+    }
+
+    // D is positive, zero or negative as x is greater than, equal to or less
+    // than y for the comparison at body[i - 1]. A following if-goto, or not
+    // and if-goto, becomes a single conditional jump; otherwise the boolean
+    // result is computed. Returns the number of commands consumed after the
+    // comparison.
+    int write_compare(VmOp op, const vector<VmInstruction>& body, size_t i) {
+        if (i < body.size() && body[i].op == VmOp::IF_GOTO) {
+            write_compare_jump(COMPARE_JUMPS.at(op), body[i].name);
+            return 1;
+        }
+        if (i + 1 < body.size() && body[i].op == VmOp::NOT && body[i + 1].op == VmOp::IF_GOTO) {
+            write_compare_jump(INVERTED_COMPARE_JUMPS.at(op), body[i + 1].name);
+            return 2;
+        }
+        write_compare_result(op);
+        return 0;
+    }
+
+    // D holds the order of x and y; jumps to label if D satisfies jump.
+    void write_compare_jump(string jump, string name) {
+        a(function_name + "$" + name);
+        c("D;" + jump);
+        top_in_d = false;
+    }
+
+    // D holds the order of x and y; replaces it with the boolean result of the
+    // comparison.
+    void write_compare_result(VmOp op) {
+        string true_label = next_return_label();
+        string end_label = next_return_label();
+        a(true_label);
+        c("D;" + COMPARE_JUMPS.at(op));
+        c("D=0");
+        a(end_label);
+        c("0;JMP");
+        label(true_label);
+        c("D=-1");
+        label(end_label);
+        top_in_d = true;
+    }
+
+    string next_return_label() {
+        return function_name + "$ret." + to_string(return_count++);
+    }
+
+    void write_trampolines() {
+        write_call_trampoline();
+        // the optimizing backend returns with the value in D
+        label(RETURN_D_TRAMPOLINE);
+        push_d();
+        write_return_trampoline();
+        for (VmOp op : {VmOp::EQ, VmOp::GT, VmOp::LT}) {
+            write_compare_trampoline(op);
+        }
+    }
+
+    // call: D = return address, R13 = argument count, R14 = callee
+    void write_call_trampoline() {
+        label(CALL_TRAMPOLINE);
+        push_d();
+        for (string pointer : {"LCL", "ARG", "THIS", "THAT"}) {
+            a(pointer);
+            c("D=M");
+            push_d();
+        }
+        a("R13");
+        c("D=M");
+        a("5");
+        c("D=D+A");
+        a("SP");
+        c("D=M-D");
+        a("ARG");
+        c("M=D");
+        a("SP");
+        c("D=M");
+        a("LCL");
+        c("M=D");
+        a("R14");
+        c("A=M");
+        c("0;JMP");
+    }
+
+    void write_return_trampoline() {
+        label(RETURN_TRAMPOLINE);
+        a("LCL");
+        c("D=M");
+        a("R13");
+        c("M=D");
+        a("5");
+        c("A=D-A");
+        c("D=M");
+        a("R14");
+        c("M=D");
+        a("SP");
+        c("AM=M-1");
+        c("D=M");
+        a("ARG");
+        c("A=M");
+        c("M=D");
+        a("ARG");
+        c("D=M+1");
+        a("SP");
+        c("M=D");
+        for (string pointer : {"THAT", "THIS", "ARG", "LCL"}) {
+            a("R13");
+            c("AM=M-1");
+            c("D=M");
+            a(pointer);
+            c("M=D");
+        }
+        a("R14");
+        c("A=M");
+        c("0;JMP");
+    }
+
+    // comparisons: D = return address, result replaces the top two values
+    void write_compare_trampoline(VmOp op) {
+        string name = COMPARE_TRAMPOLINES.at(op);
+        label(name);
+        a("R15");
+        c("M=D");
+        if (op == VmOp::EQ) {
+            a("SP");
+            c("AM=M-1");
+            c("D=M");
+            c("A=A-1");
+            c("D=M-D");
+            c("M=-1");
+        } else {
+            a("SP");
+            c("AM=M-1");
+            c("D=M");
+            a("R14");
+            c("M=D");
+            a("SP");
+            c("A=M-1");
+            c("D=M");
+            a("R13");
+            c("M=D");
+            write_ordered_difference(name + "_SUB", name + "_DIFFERENCE");
+            a("SP");
+            c("A=M-1");
+            c("M=-1");
+        }
+        a(name + "_END");
+        c("D;" + COMPARE_JUMPS.at(op));
+        a("SP");
+        c("A=M-1");
+        c("M=0");
+        label(name + "_END");
+        a("R15");
+        c("A=M");
+        c("0;JMP");
+    }
+
+    // R13 = x, R14 = y and D = x. Sets D to a value that is positive, zero or
+    // negative as x is greater than, equal to or less than y. x - y overflows
+    // when the signs differ, so it is only computed when they do not; when
+    // they do, x | 1 has the sign of x and is never zero.
+    void write_ordered_difference(string sub_label, string end_label) {
+        a("R14");
+        c("D=D|M");
+        a(sub_label);
+        c("D;JGE");
+        a("R13");
+        c("D=M");
+        a("R14");
+        c("D=D&M");
+        a(sub_label);
+        c("D;JLT");
+        a("R13");
+        c("D=M");
+        a("1");
+        c("D=D|A");
+        a(end_label);
+        c("0;JMP");
+        label(sub_label);
+        a("R14");
+        c("D=M");
+        a("R13");
+        c("D=M-D");
+        label(end_label);
+    }
+
+    void push_d() {
+        a("SP");
+        c("AM=M+1");
+        c("A=A-1");
+        c("M=D");
+    }
+
+    void a(string value) {
+        lines.push_back("@" + value);
+    }
+
+    void c(string instruction) {
+        lines.push_back(instruction);
+    }
+
+    void label(string name) {
+        lines.push_back("(" + name + ")");
+    }
+
+};
+
+#endif // HACK_BACKEND_CPP
\ No newline at end of file
@@ -0,0 +1,263 @@
+#ifndef INLINER_CPP
+#define INLINER_CPP
+
+#include "vm_code.cpp"
+#include "profile.cpp"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+using namespace std;
+
+// With a profile, callees reached through a call edge that makes up at least
+// 1/HOT_EDGE_DIVISOR of all calls get HOT_BUDGET_FACTOR times the budget, and
+// callees that never ran are not inlined at all.
+static const int HOT_EDGE_DIVISOR = 100;
+static const int HOT_BUDGET_FACTOR = 2;
+
+// Replaces calls to small, non-recursive subroutines of the program with a
+// copy of their body. The callee's arguments and locals are moved into fresh
+// local slots of the caller, and its labels are renamed so they stay unique.
+class Inliner
+{
+public:
+    Inliner(VmProgram& program, int budget, const Profile* profile = nullptr) {
+        this->program = &program;
+        this->budget = budget;
+        this->profile = profile;
+    }
+
+    int run() {
+        inlined_count = 0;
+        for (auto& vm_class : program->classes) {
+            for (auto& function : vm_class.functions) {
+                functions[function.name] = &function;
+            }
+        }
+        find_recursive_functions();
+        total_calls = profile != nullptr ? profile->total_calls() : 0;
+
+        // callees are visited before their callers, so the body that gets
+        // copied into a caller has already been inlined itself
+        for (VmFunction* function : bottom_up_order) {
+            inline_calls(*function);
+        }
+        return inlined_count;
+    }
+
+private:
+    VmProgram* program;
+    int budget;
+    const Profile* profile;
+    long long total_calls;
+    int inlined_count;
+
+    unordered_map<string, VmFunction*> functions;
+    unordered_set<string> recursive;
+    vector<VmFunction*> bottom_up_order;
+
+    // Tarjan's strongly connected components over the call graph
+    unordered_map<string, int> scc_index;
+    unordered_map<string, int> scc_low_link;
+    unordered_set<string> on_stack;
+    vector<string> scc_stack;
+    int next_index = 0;
+
+    void find_recursive_functions() {
+        for (const auto& entry : functions) {
+            if (scc_index.find(entry.first) == scc_index.end()) {
+                visit(entry.first);
+            }
+        }
+    }
+
+    void visit(const string& name) {
+        scc_index[name] = next_index;
+        scc_low_link[name] = next_index;
+        next_index++;
+        scc_stack.push_back(name);
+        on_stack.insert(name);
+
+        bool calls_itself = false;
+        for (const auto& instruction : functions[name]->body) {
+            if (instruction.op != VmOp::CALL) continue;
+            const string& callee = instruction.name;
+            if (functions.find(callee) == functions.end()) continue;
+
+            if (callee == name) {
+                calls_itself = true;
+            } else if (scc_index.find(callee) == scc_index.end()) {
+                visit(callee);
+                scc_low_link[name] = min(scc_low_link[name], scc_low_link[callee]);
+            } else if (on_stack.count(callee) > 0) {
+                scc_low_link[name] = min(scc_low_link[name], scc_index[callee]);
+            }
+        }
+
+        if (scc_low_link[name] == scc_index[name]) {
+            vector<string> component;
+            string member;
+            do {
+                member = scc_stack.back();
+                scc_stack.pop_back();
+                on_stack.erase(member);
+                component.push_back(member);
+            } while (member != name);
+
+            if (component.size() > 1 || calls_itself) {
+                recursive.insert(component.begin(), component.end());
+            }
+            for (const auto& function : component) {
+                bottom_up_order.push_back(functions[function]);
+            }
+        }
+    }
+
+    bool can_inline(const VmFunction& caller, const VmInstruction& call) {
+        auto callee_entry = functions.find(call.name);
+        if (callee_entry == functions.end()) return false;
+        const VmFunction& callee = *callee_entry->second;
+
+        if (callee.name == caller.name) return false;
+        if (recursive.count(callee.name) > 0) return false;
+        if (callee.n_args < 0 || callee.n_args != call.index) return false;
+        if ((int)callee.body.size() > budget_for(caller, callee)) return false;
+
+        // static variables are resolved per class, so they cannot be moved
+        if (class_of(callee.name) != class_of(caller.name)) {
+            for (const auto& instruction : callee.body) {
+                if (instruction.segment == Segment::STATIC) return false;
+            }
+        }
+        return true;
+    }
+
+    int budget_for(const VmFunction& caller, const VmFunction& callee) {
+        if (profile == nullptr) return budget;
+
+        long long count = profile->edge_count(caller.name, callee.name);
+        if (count == 0) {
+            // calls copied in by an earlier inlining step have no edge of their own
+            count = profile->calls_of(callee.name);
+        }
+        if (count == 0) return 0;
+        if (count * HOT_EDGE_DIVISOR >= total_calls) return budget * HOT_BUDGET_FACTOR;
+        return budget;
+    }
+
+    void inline_calls(VmFunction& caller) {
+        vector<VmInstruction> body;
+        int site_count = 0;
+        for (size_t i = 0; i < caller.body.size(); i++) {
+            const VmInstruction& instruction = caller.body[i];
+            if (instruction.op == VmOp::CALL && can_inline(caller, instruction)) {
+                bool keep_that = uses_that_before_set(caller.body, i + 1);
+                inline_call(caller, *functions[instruction.name], site_count++, keep_that, body);
+                inlined_count++;
+            } else {
+                body.push_back(instruction);
+            }
+        }
+        caller.body = body;
+    }
+
+    // keep_that is set if the caller uses pointer 1 after the call, which the
+    // call would have kept.
+    void inline_call(VmFunction& caller, const VmFunction& callee, int site, bool keep_that, vector<VmInstruction>& body) {
+        string prefix = "INLINE" + to_string(site) + "_";
+        string end_label = prefix + "END";
+
+        int args_base = caller.n_locals;
+        int locals_base = args_base + callee.n_args;
+        caller.n_locals = locals_base + callee.n_locals;
+
+        // A method or constructor sets pointer 0 to its object. If the callee
+        // never touches the that segment, its this segment is moved there
+        // instead, which leaves the caller's pointer 0 alone. Otherwise the
+        // caller's pointer 0 is saved around the inlined body.
+        bool uses_that = false;
+        bool sets_this = false;
+        for (const auto& instruction : callee.body) {
+            if (instruction.segment == Segment::THAT || instruction.is(VmOp::PUSH, Segment::POINTER, 1) || instruction.is(VmOp::POP, Segment::POINTER, 1)) {
+                uses_that = true;
+            }
+            if (instruction.is(VmOp::POP, Segment::POINTER, 0)) {
+                sets_this = true;
+            }
+        }
+        bool this_to_that = sets_this && !uses_that;
+        int saved_this = -1;
+        if (sets_this && uses_that) {
+            saved_this = caller.n_locals++;
+        }
+        int saved_that = -1;
+        if (keep_that && (uses_that || this_to_that)) {
+            saved_that = caller.n_locals++;
+        }
+
+        for (int i = callee.n_args - 1; i >= 0; i--) {
+            body.push_back(VmInstruction::pop(Segment::LOCAL, args_base + i));
+        }
+        for (int i = 0; i < callee.n_locals; i++) {
+            body.push_back(VmInstruction::push(Segment::CONSTANT, 0));
+            body.push_back(VmInstruction::pop(Segment::LOCAL, locals_base + i));
+        }
+        if (saved_this >= 0) {
+            body.push_back(VmInstruction::push(Segment::POINTER, 0));
+            body.push_back(VmInstruction::pop(Segment::LOCAL, saved_this));
+        }
+        if (saved_that >= 0) {
+            body.push_back(VmInstruction::push(Segment::POINTER, 1));
+            body.push_back(VmInstruction::pop(Segment::LOCAL, saved_that));
+        }
+
+        bool needs_end_label = false;
+        for (size_t i = 0; i < callee.body.size(); i++) {
+            VmInstruction instruction = callee.body[i];
+            switch (instruction.op) {
+                case VmOp::PUSH:
+                case VmOp::POP:
+                    if (instruction.segment == Segment::ARGUMENT) {
+                        instruction.segment = Segment::LOCAL;
+                        instruction.index += args_base;
+                    } else if (instruction.segment == Segment::LOCAL) {
+                        instruction.index += locals_base;
+                    } else if (this_to_that && instruction.segment == Segment::THIS) {
+                        instruction.segment = Segment::THAT;
+                    } else if (this_to_that && instruction.segment == Segment::POINTER && instruction.index == 0) {
+                        instruction.index = 1;
+                    }
+                    break;
+                case VmOp::LABEL:
+                case VmOp::GOTO:
+                case VmOp::IF_GOTO:
+                    instruction.name = prefix + instruction.name;
+                    break;
+                case VmOp::RETURN:
+                    // the return value is the only thing left on the stack
+                    if (i + 1 == callee.body.size()) continue;
+                    instruction = VmInstruction::jump(VmOp::GOTO, end_label);
+                    needs_end_label = true;
+                    break;
+                default:
+                    break;
+            }
+            body.push_back(instruction);
+        }
+
+        if (needs_end_label) {
+            body.push_back(VmInstruction::label(end_label));
+        }
+        if (saved_this >= 0) {
+            body.push_back(VmInstruction::push(Segment::LOCAL, saved_this));
+            body.push_back(VmInstruction::pop(Segment::POINTER, 0));
+        }
+        if (saved_that >= 0) {
+            body.push_back(VmInstruction::push(Segment::LOCAL, saved_that));
+            body.push_back(VmInstruction::pop(Segment::POINTER, 1));
+        }
+    }
+
+};
+
+#endif // INLINER_CPP
\ No newline at end of file
@@ -0,0 +1,255 @@
+#ifndef INTERFACE_CPP
+#define INTERFACE_CPP
+
+#include "vm_code.cpp"
+#include "vm_bytecode.cpp"
+#include "diagnostics.cpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+static const string INTERFACE_MAGIC = "JIFC";
+static const int INTERFACE_VERSION = 3;
+
+// what a caller sees of a subroutine that is not defined, or of one in a
+// class the program does not have
+static const uint64_t MISSING_VIEW = 1;
+static const uint64_t UNKNOWN_VIEW = 0;
+
+uint64_t fnv1a_hash(const string& data, uint64_t hash = 14695981039346656037ULL) {
+    for (char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+struct SubroutineInterface {
+    string name;
+    string kind;
+    string return_type;
+    int n_args;
+};
+
+// What other classes can see of a class: its subroutines with their kind
+// (constructor, function or method), return type and declared argument count
+// (without this), and how many fields and static variables it has.
+struct ClassInterface {
+    string name;
+    int n_fields = 0;
+    int n_statics = 0;
+    vector<SubroutineInterface> subroutines;
+
+    const SubroutineInterface* find(const string& subroutine) const {
+        for (const auto& entry : subroutines) {
+            if (entry.name == subroutine) return &entry;
+        }
+        return nullptr;
+    }
+};
+
+// A call to a subroutine of a named class, as written in the source.
+// is_method_call is set for calls on an object or on this; n_args does not
+// count the object.
+struct CallSite {
+    string class_name;
+    string subroutine;
+    int n_args;
+    bool is_method_call;
+    string file;
+    int line;
+    int column;
+};
+
+typedef unordered_map<string, const ClassInterface*> InterfaceTable;
+
+// Hash of what a caller relies on about Class.subroutine; it changes only if
+// the call would compile or check differently.
+uint64_t view_of(const InterfaceTable& table, const string& class_name, const string& subroutine) {
+    auto entry = table.find(class_name);
+    if (entry == table.end()) return UNKNOWN_VIEW;
+    const SubroutineInterface* callee = entry->second->find(subroutine);
+    if (callee == nullptr) return MISSING_VIEW;
+    return fnv1a_hash(callee->kind + " " + callee->return_type + " " + to_string(callee->n_args));
+}
+
+// Checks calls into classes of the program against their interfaces and
+// records, for each called subroutine, the view the caller depends on.
+// Calls into classes the table does not have (such as the OS) are not
+// checked. Returns false if a call does not match.
+bool check_calls(const vector<CallSite>& calls, const InterfaceTable& table, Diagnostics& diagnostics, unordered_map<string, uint64_t>& dependencies) {
+    bool valid = true;
+    for (const auto& call : calls) {
+        string name = call.class_name + "." + call.subroutine;
+        dependencies[name] = view_of(table, call.class_name, call.subroutine);
+
+        auto entry = table.find(call.class_name);
+        if (entry == table.end()) continue;
+        const SubroutineInterface* callee = entry->second->find(call.subroutine);
+        string message;
+        if (callee == nullptr) {
+            message = "subroutine " + name + " is not defined";
+        } else if (call.is_method_call && callee->kind != "method") {
+            message = callee->kind + " " + name + " is called as a method";
+        } else if (!call.is_method_call && callee->kind == "method") {
+            message = "method " + name + " is called without an object";
+        } else if (call.n_args != callee->n_args) {
+            message = name + " takes " + to_string(callee->n_args) + " argument(s), but is called with " + to_string(call.n_args);
+        } else {
+            continue;
+        }
+        diagnostics.error(call.file, call.line, call.column, message);
+        valid = false;
+    }
+    return valid;
+}
+
+// A class as kept in its interface file (.jif) next to the .vm output, so an
+// unchanged class does not have to be compiled again. Little endian:
+//
+//   header        "JIFC", version u16, source hash u64, options hash u64
+//   interface     name, fields u16, statics u16, subroutine count u16, and
+//                 for each subroutine: name, kind, return type, arguments u16
+//   dependencies  count u16, and for each: Class.subroutine, view hash u64
+//   code          the class as compiled, before whole-program passes, in
+//                 .vmb format
+//
+// Strings are a u16 length followed by the bytes. The code is only read when
+// the class is reused.
+class CachedClass
+{
+public:
+    uint64_t source_hash = 0;
+    uint64_t options_hash = 0;
+    ClassInterface interface;
+    unordered_map<string, uint64_t> dependencies;
+
+    // Reads everything but the code.
+    bool load(const string& path) {
+        ifstream input(path, ios::binary);
+        if (!input.is_open()) return false;
+        this->path = path;
+
+        string magic(INTERFACE_MAGIC.length(), '\0');
+        input.read(&magic[0], magic.length());
+        if (magic != INTERFACE_MAGIC || u16(input) != INTERFACE_VERSION) return false;
+        source_hash = u64(input);
+        options_hash = u64(input);
+
+        interface.name = str(input);
+        interface.n_fields = u16(input);
+        interface.n_statics = u16(input);
+        interface.subroutines.resize(u16(input));
+        for (auto& subroutine : interface.subroutines) {
+            subroutine.name = str(input);
+            subroutine.kind = str(input);
+            subroutine.return_type = str(input);
+            subroutine.n_args = u16(input);
+        }
+
+        int n_dependencies = u16(input);
+        for (int i = 0; i < n_dependencies; i++) {
+            string name = str(input);
+            dependencies[name] = u64(input);
+        }
+        code_offset = input.tellg();
+        return static_cast<bool>(input);
+    }
+
+    // Whether every subroutine the class calls still looks the way it did
+    // when the class was compiled.
+    bool is_up_to_date(const InterfaceTable& table) const {
+        for (const auto& dependency : dependencies) {
+            string name = dependency.first;
+            auto separator = name.find('.');
+            if (view_of(table, name.substr(0, separator), name.substr(separator + 1)) != dependency.second) return false;
+        }
+        return true;
+    }
+
+    bool load_code(VmClass& vm_class) const {
+        ifstream input(path, ios::binary);
+        input.seekg(code_offset);
+        BytecodeReader reader;
+        return input.is_open() && reader.read(input, vm_class);
+    }
+
+    bool save(ostream& output, const VmClass& vm_class) const {
+        stringstream code;
+        BytecodeWriter writer;
+        if (!writer.write(vm_class, code)) return false;
+
+        output.write(INTERFACE_MAGIC.data(), INTERFACE_MAGIC.length());
+        u16(output, INTERFACE_VERSION);
+        u64(output, source_hash);
+        u64(output, options_hash);
+
+        str(output, interface.name);
+        u16(output, interface.n_fields);
+        u16(output, interface.n_statics);
+        u16(output, interface.subroutines.size());
+        for (const auto& subroutine : interface.subroutines) {
+            str(output, subroutine.name);
+            str(output, subroutine.kind);
+            str(output, subroutine.return_type);
+            u16(output, subroutine.n_args);
+        }
+
+        u16(output, dependencies.size());
+        for (const auto& dependency : dependencies) {
+            str(output, dependency.first);
+            u64(output, dependency.second);
+        }
+        output << code.rdbuf();
+        return static_cast<bool>(output);
+    }
+
+private:
+    string path;
+    streamoff code_offset = 0;
+
+    static int u16(istream& input) {
+        unsigned char bytes[2] = {0, 0};
+        input.read(reinterpret_cast<char*>(bytes), 2);
+        return bytes[0] | (bytes[1] << 8);
+    }
+
+    static uint64_t u64(istream& input) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 16) {
+            value |= static_cast<uint64_t>(u16(input)) << shift;
+        }
+        return value;
+    }
+
+    static string str(istream& input) {
+        int length = u16(input);
+        string value(length, '\0');
+        if (length > 0) input.read(&value[0], length);
+        return input ? value : "";
+    }
+
+    static void u16(ostream& output, int value) {
+        output.put(static_cast<char>(value & 0xFF));
+        output.put(static_cast<char>((value >> 8) & 0xFF));
+    }
+
+    static void u64(ostream& output, uint64_t value) {
+        for (int shift = 0; shift < 64; shift += 16) {
+            u16(output, (value >> shift) & 0xFFFF);
+        }
+    }
+
+    static void str(ostream& output, const string& value) {
+        u16(output, value.length());
+        output.write(value.data(), value.length());
+    }
+
+};
+
+#endif // INTERFACE_CPP
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef INTRINSICS_CPP
+#define INTRINSICS_CPP
+
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+
+using namespace std;
+
+struct Intrinsic {
+    int n_args;
+    vector<VmInstruction> code;
+};
+
+// OS subroutines that are short enough to be written out in place of the
+// call. Each sequence takes the call's arguments from the stack and leaves
+// the value the call would return; temp 0 and temp 1 are scratch. min and max
+// pick a value without jumping: b + ((a - b) & (a < b)) is a if a < b and b
+// otherwise, and abs(x) is x - 2 * (x & (x < 0)).
+static const unordered_map<string, Intrinsic> INTRINSICS = {
+    {"Memory.peek", {1, {
+        VmInstruction::pop(Segment::POINTER, 1),
+        VmInstruction::push(Segment::THAT, 0),
+    }}},
+    {"Memory.poke", {2, {
+        VmInstruction::pop(Segment::TEMP, 0),
+        VmInstruction::pop(Segment::POINTER, 1),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::pop(Segment::THAT, 0),
+        VmInstruction::push(Segment::CONSTANT, 0),
+    }}},
+    {"Math.abs", {1, {
+        VmInstruction::pop(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::CONSTANT, 0),
+        VmInstruction::arithmetic(VmOp::LT),
+        VmInstruction::arithmetic(VmOp::AND),
+        VmInstruction::pop(Segment::TEMP, 1),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::SUB),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::SUB),
+    }}},
+    {"Math.min", {2, {
+        VmInstruction::pop(Segment::TEMP, 1),
+        VmInstruction::pop(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::SUB),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::LT),
+        VmInstruction::arithmetic(VmOp::AND),
+        VmInstruction::arithmetic(VmOp::ADD),
+    }}},
+    {"Math.max", {2, {
+        VmInstruction::pop(Segment::TEMP, 1),
+        VmInstruction::pop(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::SUB),
+        VmInstruction::push(Segment::TEMP, 0),
+        VmInstruction::push(Segment::TEMP, 1),
+        VmInstruction::arithmetic(VmOp::GT),
+        VmInstruction::arithmetic(VmOp::AND),
+        VmInstruction::arithmetic(VmOp::ADD),
+    }}},
+};
+
+// Replaces calls to the intrinsics with their sequences. A class the program
+// defines itself replaces the OS class, so its subroutines are called as
+// usual. Sequences that set pointer 1 keep the caller's pointer 1 in temp 1
+// when the caller still uses it, as a call would; the value of a void call
+// that is popped right away is not pushed at all. Returns the number of
+// calls replaced.
+int expand_intrinsics(VmProgram& program) {
+    unordered_set<string> program_classes = defined_classes(program);
+
+    int expanded = 0;
+    for (auto& vm_class : program.classes) {
+        for (auto& function : vm_class.functions) {
+            vector<VmInstruction> body;
+            for (size_t i = 0; i < function.body.size(); i++) {
+                const VmInstruction& instruction = function.body[i];
+                auto intrinsic = INTRINSICS.find(instruction.name);
+                bool is_intrinsic = instruction.op == VmOp::CALL && intrinsic != INTRINSICS.end() &&
+                    intrinsic->second.n_args == instruction.index && program_classes.count(class_of(instruction.name)) == 0;
+                if (!is_intrinsic) {
+                    body.push_back(instruction);
+                    continue;
+                }
+
+                vector<VmInstruction> code = intrinsic->second.code;
+                bool result_discarded = code.back().is(VmOp::PUSH, Segment::CONSTANT, 0) && i + 1 < function.body.size() &&
+                    function.body[i + 1].is(VmOp::POP, Segment::TEMP, 0);
+                if (result_discarded) {
+                    code.pop_back();
+                    i++;
+                }
+                bool sets_that = false;
+                for (const auto& command : code) {
+                    if (command.is(VmOp::POP, Segment::POINTER, 1)) sets_that = true;
+                }
+                bool keep_that = sets_that && uses_that_before_set(function.body, i + 1);
+
+                if (keep_that) {
+                    body.push_back(VmInstruction::push(Segment::POINTER, 1));
+                    body.push_back(VmInstruction::pop(Segment::TEMP, 1));
+                }
+                body.insert(body.end(), code.begin(), code.end());
+                if (keep_that) {
+                    body.push_back(VmInstruction::push(Segment::TEMP, 1));
+                    body.push_back(VmInstruction::pop(Segment::POINTER, 1));
+                }
+                expanded++;
+            }
+            function.body = body;
+        }
+    }
+    return expanded;
+}
+
+#endif // INTRINSICS_CPP
\ No newline at end of file
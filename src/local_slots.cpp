@@ -0,0 +1,158 @@
+#ifndef LOCAL_SLOTS_CPP
+#define LOCAL_SLOTS_CPP
+
+#include "vm_code.cpp"
+#include "cfg.cpp"
+#include <vector>
+
+using namespace std;
+
+// Which local slots are live (may still be read) at the start and end of
+// every block of a control-flow graph. push local k is a use of k and
+// pop local k a definition.
+class LocalLiveness
+{
+public:
+    vector<vector<bool>> live_in;
+    vector<vector<bool>> live_out;
+
+    LocalLiveness(const ControlFlowGraph& graph, int n_locals) {
+        size_t n_blocks = graph.blocks.size();
+        live_in.assign(n_blocks, vector<bool>(n_locals, false));
+        live_out.assign(n_blocks, vector<bool>(n_locals, false));
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int block = n_blocks - 1; block >= 0; block--) {
+                vector<bool> live(n_locals, false);
+                for (int successor : graph.successors(block)) {
+                    for (int k = 0; k < n_locals; k++) {
+                        if (live_in[successor][k]) live[k] = true;
+                    }
+                }
+                live_out[block] = live;
+
+                const auto& body = graph.blocks[block].body;
+                for (auto instruction = body.rbegin(); instruction != body.rend(); instruction++) {
+                    step(*instruction, live);
+                }
+                if (live != live_in[block]) {
+                    live_in[block] = live;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Turns the live set after instruction into the live set before it.
+    static void step(const VmInstruction& instruction, vector<bool>& live) {
+        if (instruction.segment != Segment::LOCAL || instruction.index >= (int)live.size()) return;
+        if (instruction.op == VmOp::POP) {
+            live[instruction.index] = false;
+        } else if (instruction.op == VmOp::PUSH) {
+            live[instruction.index] = true;
+        }
+    }
+
+};
+
+// Removes stores to locals that are never read afterwards and gives locals
+// whose lifetimes do not overlap the same slot, so the function command has
+// fewer slots to clear. Locals that are never written read as 0. Returns the
+// number of local slots saved.
+int reuse_local_slots(VmFunction& function) {
+    int n_locals = function.n_locals;
+    if (n_locals == 0) return 0;
+
+    ControlFlowGraph graph(function.body);
+
+    // dead stores: a pure push right before one is dropped with it
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        LocalLiveness liveness(graph, n_locals);
+        for (size_t block = 0; block < graph.blocks.size(); block++) {
+            vector<VmInstruction>& body = graph.blocks[block].body;
+            vector<bool> live = liveness.live_out[block];
+            vector<bool> dead(body.size(), false);
+            for (int i = body.size() - 1; i >= 0; i--) {
+                const VmInstruction& instruction = body[i];
+                bool is_local_store = instruction.op == VmOp::POP && instruction.segment == Segment::LOCAL && instruction.index < n_locals;
+                if (is_local_store && !live[instruction.index]) {
+                    dead[i] = true;
+                }
+                LocalLiveness::step(instruction, live);
+            }
+
+            vector<VmInstruction> kept;
+            for (size_t i = 0; i < body.size(); i++) {
+                if (!dead[i]) {
+                    kept.push_back(body[i]);
+                } else if (!kept.empty() && kept.back().op == VmOp::PUSH && (i == 0 || !dead[i - 1])) {
+                    kept.pop_back();
+                    changed = true;
+                } else {
+                    kept.push_back(VmInstruction::pop(Segment::TEMP, 0));
+                    changed = true;
+                }
+            }
+            body = kept;
+        }
+    }
+
+    // interference: a local written while another one is live
+    LocalLiveness liveness(graph, n_locals);
+    vector<vector<bool>> interferes(n_locals, vector<bool>(n_locals, false));
+    vector<bool> is_written(n_locals, false);
+    for (size_t block = 0; block < graph.blocks.size(); block++) {
+        const vector<VmInstruction>& body = graph.blocks[block].body;
+        vector<bool> live = liveness.live_out[block];
+        for (auto instruction = body.rbegin(); instruction != body.rend(); instruction++) {
+            if (instruction->segment == Segment::LOCAL && instruction->index < n_locals) {
+                int k = instruction->index;
+                if (instruction->op == VmOp::POP) {
+                    is_written[k] = true;
+                    for (int other = 0; other < n_locals; other++) {
+                        if (live[other] && other != k) {
+                            interferes[k][other] = true;
+                            interferes[other][k] = true;
+                        }
+                    }
+                }
+            }
+            LocalLiveness::step(*instruction, live);
+        }
+    }
+
+    vector<int> slot(n_locals, -1);
+    int n_slots = 0;
+    for (int k = 0; k < n_locals; k++) {
+        if (!is_written[k]) continue;
+        vector<bool> taken(n_slots, false);
+        for (int other = 0; other < k; other++) {
+            if (interferes[k][other] && slot[other] >= 0) taken[slot[other]] = true;
+        }
+        slot[k] = 0;
+        while (slot[k] < n_slots && taken[slot[k]]) slot[k]++;
+        n_slots = max(n_slots, slot[k] + 1);
+    }
+
+    for (auto& block : graph.blocks) {
+        for (auto& instruction : block.body) {
+            if (instruction.segment != Segment::LOCAL || instruction.index >= n_locals) continue;
+            if (slot[instruction.index] >= 0) {
+                instruction.index = slot[instruction.index];
+            } else {
+                // never written, so it still holds the 0 the function started with
+                instruction = VmInstruction::push(Segment::CONSTANT, 0);
+            }
+        }
+    }
+
+    function.body = graph.to_instructions();
+    function.n_locals = n_slots;
+    return n_locals - n_slots;
+}
+
+#endif // LOCAL_SLOTS_CPP
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef LOG_CPP
+#define LOG_CPP
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+enum class LogLevel {
+    ERROR,
+    WARN,
+    INFO,
+    DEBUG
+};
+
+// Messages above this level are compiled out together with the code that
+// formats them; build with -DLOG_MAX_LEVEL=2 to drop debug messages.
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 3
+#endif
+
+// Messages of the compiler, by level. Each thread collects its messages in a
+// buffer of its own and writes them out in one piece on flush(), so the
+// messages of files compiled in parallel do not interleave and writing them
+// does not flush cout line by line.
+class Log
+{
+public:
+    static void set_level(LogLevel level) {
+        current_level = static_cast<int>(level);
+    }
+
+    static bool enabled(LogLevel level) {
+        return static_cast<int>(level) <= current_level;
+    }
+
+    static void write(LogLevel level, const string& message) {
+        buffer += message;
+        buffer += '\n';
+        if (warnings != nullptr && level <= LogLevel::WARN) {
+            *warnings += message;
+            *warnings += '\n';
+        }
+    }
+
+    // Also appends the calling thread's errors and warnings to *sink as they
+    // are logged, or stops doing so if sink is nullptr.
+    static void copy_warnings(string* sink) {
+        warnings = sink;
+    }
+
+    static void flush() {
+        if (buffer.empty()) return;
+        lock_guard<mutex> lock(write_mutex);
+        cout << buffer;
+        buffer.clear();
+    }
+
+private:
+    static atomic<int> current_level;
+    static mutex write_mutex;
+    static thread_local string buffer;
+    static thread_local string* warnings;
+};
+
+atomic<int> Log::current_level(static_cast<int>(LogLevel::INFO));
+mutex Log::write_mutex;
+thread_local string Log::buffer;
+thread_local string* Log::warnings = nullptr;
+
+// LOG(LogLevel::INFO, "Wrote " << count << " files.") logs a message built
+// with <<; it is only built if the level is enabled.
+#define LOG(level, message)                                           \
+    do {                                                              \
+        if constexpr (static_cast<int>(level) <= LOG_MAX_LEVEL) {     \
+            if (Log::enabled(level)) {                                \
+                ostringstream log_message;                            \
+                log_message << message;                               \
+                Log::write(level, log_message.str());                 \
+            }                                                         \
+        }                                                             \
+    } while (false)
+
+#define LOG_ERROR(message) LOG(LogLevel::ERROR, message)
+#define LOG_WARN(message) LOG(LogLevel::WARN, message)
+#define LOG_INFO(message) LOG(LogLevel::INFO, message)
+#define LOG_DEBUG(message) LOG(LogLevel::DEBUG, message)
+
+#endif // LOG_CPP
\ No newline at end of file
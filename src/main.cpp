@@ -1,59 +1,378 @@
 #include "tokenizer.cpp"
 #include "compiler.cpp"
+#include "interface.cpp"
+#include "passes.cpp"
+#include "hack_backend.cpp"
+#include "hack_assembler.cpp"
+#include "report.cpp"
+#include "vm_interpreter.cpp"
+#include "vm_bytecode.cpp"
+#include "options.cpp"
+#include "batch.cpp"
+#include "output_writer.cpp"
+#include "log.cpp"
 #include <fstream>
 #include <filesystem>
+#include <mutex>
 
 using namespace std;
 namespace fs = filesystem;
 
 static const string INPUT_TYPE = ".jack";
 static const string OUTPUT_TYPE = ".vm";
+static const string BYTECODE_TYPE = ".vmb";
+static const string ASM_TYPE = ".asm";
+static const string HACK_TYPE = ".hack";
+static const string INTERFACE_TYPE = ".jif";
 
-void to_file(fs::path path) {
-    Tokenizer t(path);
-    Compiler c(t);
-    string outputFileName = 
+// A .jack file of the program, either compiled or reused from its interface
+// file. cache holds its interface and, once checked, its dependencies.
+struct SourceClass {
+    fs::path path;
+    bool reused = false;
+    CachedClass cache;
+    VmClass vm_class;
+    vector<CallSite> calls;
+};
+
+void compile_file(SourceClass& source, const Profile* profile, Diagnostics& diagnostics) {
+    Tokenizer t(source.path, diagnostics);
+    Compiler c(t, diagnostics, profile);
+    source.vm_class = c.compile();
+    source.cache.interface = c.interface();
+    source.calls = c.call_sites();
+    source.reused = false;
+    Log::flush();
+}
+
+fs::path interface_path(fs::path path) {
+    return path.replace_extension(INTERFACE_TYPE);
+}
+
+string read_file(fs::path path) {
+    ifstream inputFile(path, ios::binary);
+    stringstream contents;
+    contents << inputFile.rdbuf();
+    return contents.str();
+}
+
+void to_file(fs::path path, const VmClass& vm_class, bool bytecode, OutputWriter& output) {
+    string outputFileName =
         path.parent_path().string() +
         fs::path::preferred_separator +
         path.stem().string() +
-        OUTPUT_TYPE;
-    ofstream outputFile(outputFileName);
-    if (outputFile.is_open()) {
-        outputFile << c.compile();
-        outputFile.close();
+        (bytecode ? BYTECODE_TYPE : OUTPUT_TYPE);
+    if (bytecode) {
+        stringstream contents;
+        BytecodeWriter writer;
+        if (writer.write(vm_class, contents)) {
+            output.write(outputFileName, contents.str());
+        }
     } else {
-        cout << "Failed to open output file: " << outputFileName << '\n';
+        output.write(outputFileName, to_vm_text(vm_class));
     }
 }
 
-int main(int argc, char *argv[])
-{
-    fs::path path = argv[1];
-    if (path.string().back() == fs::path::preferred_separator) {
-        path = path.parent_path();
+void print_output_counts(const OutputWriter& output) {
+    LOG_INFO("Wrote " << output.written << " files, " << output.unchanged << " unchanged.");
+}
+
+// Library classes already read, by name and contents. Programs of a batch
+// often link the same OS files, which are then only parsed once.
+static mutex library_cache_mutex;
+static unordered_map<uint64_t, VmClass> library_cache;
+
+bool load_vm_file(fs::path path, VmProgram& program) {
+    string contents = read_file(path);
+    uint64_t key = fnv1a_hash(contents, fnv1a_hash(path.filename().string()));
+    {
+        lock_guard<mutex> lock(library_cache_mutex);
+        auto entry = library_cache.find(key);
+        if (entry != library_cache.end()) {
+            program.classes.push_back(entry->second);
+            return true;
+        }
+    }
+
+    VmClass vm_class;
+    vm_class.name = path.stem().string();
+    istringstream inputFile(contents);
+    if (path.extension() == BYTECODE_TYPE) {
+        BytecodeReader reader;
+        if (!reader.read(inputFile, vm_class)) return false;
+    } else {
+        if (!parse_vm_text(inputFile, vm_class)) return false;
+    }
+    program.classes.push_back(vm_class);
+
+    lock_guard<mutex> lock(library_cache_mutex);
+    library_cache[key] = vm_class;
+    return true;
+}
+
+// Converts a .vmb file, or every .vmb file in a directory, back to .vm text.
+int bytecode_to_text(fs::path path) {
+    vector<fs::path> paths;
+    if (fs::is_directory(path)) {
+        for (const auto& entry : fs::directory_iterator(path)) {
+            if (entry.path().extension() == BYTECODE_TYPE) {
+                paths.push_back(entry.path());
+            }
+        }
+    } else if (fs::is_regular_file(path) && path.extension() == BYTECODE_TYPE) {
+        paths.push_back(path);
+    } else {
+        LOG_ERROR("Invalid argument: " << path);
+        return 1;
+    }
+
+    OutputWriter output;
+    for (const auto& path : paths) {
+        VmProgram program;
+        if (!load_vm_file(path, program)) return 1;
+        to_file(path, program.classes.front(), false, output);
+    }
+    print_output_counts(output);
+    return 0;
+}
+
+void write_lines(fs::path path, const vector<string>& lines, OutputWriter& output) {
+    string contents;
+    for (const auto& line : lines) {
+        contents += line;
+        contents += '\n';
+    }
+    output.write(path, contents);
+}
+
+void translate_program(const VmProgram& program, fs::path image_path, const Options& options, OutputWriter& output) {
+    HackBackend backend(options.bootstrap, options.optimize_asm);
+    vector<string> lines = backend.translate(program);
+    write_lines(image_path.string() + ASM_TYPE, lines, output);
+
+    if (options.emit_hack) {
+        HackAssembler assembler;
+        vector<string> binary;
+        if (assembler.assemble(lines, binary)) {
+            write_lines(image_path.string() + HACK_TYPE, binary, output);
+            LOG_INFO("ROM size: " << binary.size() << " instructions.");
+        }
+    }
+}
+
+int run_program(const VmProgram& program, const Options& options, OutputWriter& output) {
+    VmInterpreter interpreter(program);
+    if (!interpreter.load()) return 1;
+    Log::flush();
+    RunResult result = interpreter.run(options.max_steps);
+    LOG_INFO("Executed " << result.instructions << " VM commands (~" << result.cycles << " Hack cycles, "
+             << result.native_calls << " native OS calls).");
+
+    if (!options.profile_gen.empty()) {
+        Profile profile;
+        interpreter.collect_profile(profile);
+        stringstream profileFile;
+        profile.save(profileFile);
+        if (!output.write(options.profile_gen, profileFile.str())) return 1;
+        LOG_INFO("Wrote profile: " << options.profile_gen.string());
+    }
+    return result.ok ? 0 : 1;
+}
+
+// image_path is the output path of the .asm/.hack image, without extension.
+// library_paths are .vm files that are linked into the image as they are.
+int compile_program(const vector<fs::path>& paths, const vector<fs::path>& library_paths, fs::path image_path, const Options& options) {
+    Profile profile;
+    const Profile* used_profile = nullptr;
+    // the profile is the only option that changes what the compiler writes
+    // before the whole-program passes
+    uint64_t options_hash = fnv1a_hash(to_string(INTERFACE_VERSION));
+    if (!options.profile_use.empty()) {
+        if (!fs::is_regular_file(options.profile_use)) {
+            LOG_ERROR("Failed to open profile file: " << options.profile_use.string());
+            return 1;
+        }
+        string profile_text = read_file(options.profile_use);
+        istringstream profileFile(profile_text);
+        if (!profile.load(profileFile)) return 1;
+        used_profile = &profile;
+        options_hash = fnv1a_hash(profile_text, options_hash);
+    }
+    VmProgram libraries;
+    PassManager passes;
+    register_passes(passes, options, used_profile, libraries);
+    if (!select_passes(passes, options, used_profile)) return 1;
+
+    Diagnostics diagnostics(options.max_errors, options.json_diagnostics);
+    vector<SourceClass> sources(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        SourceClass& source = sources[i];
+        source.path = paths[i];
+        uint64_t source_hash = fnv1a_hash(read_file(source.path));
+        if (options.incremental && source.cache.load(interface_path(source.path))) {
+            source.reused = source.cache.source_hash == source_hash && source.cache.options_hash == options_hash;
+        }
+        source.cache.source_hash = source_hash;
+        source.cache.options_hash = options_hash;
+    }
+
+    // changed classes first, so their interfaces are known when deciding
+    // whether the classes that call them can be reused
+    for (auto& source : sources) {
+        if (!source.reused && !diagnostics.limit_reached()) {
+            compile_file(source, used_profile, diagnostics);
+        }
+    }
+    InterfaceTable interfaces;
+    for (const auto& source : sources) {
+        interfaces[source.cache.interface.name] = &source.cache.interface;
+    }
+    for (auto& source : sources) {
+        if (source.reused && (!source.cache.is_up_to_date(interfaces) || !source.cache.load_code(source.vm_class))) {
+            compile_file(source, used_profile, diagnostics);
+        }
+    }
+    for (auto& source : sources) {
+        if (!source.reused) {
+            source.cache.dependencies.clear();
+            check_calls(source.calls, interfaces, diagnostics, source.cache.dependencies);
+        }
+    }
+    if (diagnostics.errors() > 0) {
+        LOG_ERROR("Compilation failed with " << diagnostics.errors() << " error(s).");
+        return 1;
+    }
+
+    OutputWriter output;
+    VmProgram program;
+    int reused_count = 0;
+    for (const auto& source : sources) {
+        program.classes.push_back(source.vm_class);
+        stringstream interfaceFile;
+        if (source.reused) {
+            reused_count++;
+        } else if (options.incremental && source.cache.save(interfaceFile, source.vm_class)) {
+            output.write(interface_path(source.path), interfaceFile.str());
+        }
+    }
+    if (options.incremental) {
+        LOG_INFO("Reused " << reused_count << " of " << sources.size() << " classes from interface files.");
+    }
+
+    // the string pool needs the statics of the libraries even if they are not
+    // linked here
+    bool link_libraries = options.emit_asm || options.run || options.report;
+    if (link_libraries || passes.is_enabled("intern-strings")) {
+        for (const auto& path : library_paths) {
+            if (!load_vm_file(path, libraries)) return 1;
+        }
+    }
+
+    // profiles are collected on the program as compiled, whose labels and
+    // calls are the ones the compiler and the passes look up in them
+    VmProgram unoptimized_program;
+    if (!options.profile_gen.empty()) unoptimized_program = program;
+    if (!passes.run(program)) return 1;
+    Log::flush();
+    if (options.time_passes) {
+        passes.print_timings(cout);
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        to_file(paths[i], program.classes[i], options.emit_bytecode, output);
+    }
+
+    if (link_libraries) {
+        for (const auto& vm_class : libraries.classes) {
+            program.classes.push_back(vm_class);
+            if (!options.profile_gen.empty()) unoptimized_program.classes.push_back(vm_class);
+        }
+    }
+    Log::flush();
+    if (options.report) {
+        write_report(program, options.bootstrap, options.optimize_asm, cout);
     }
-    
+    if (options.emit_asm) {
+        translate_program(program, image_path, options, output);
+    }
+    int status = options.run ? run_program(options.profile_gen.empty() ? program : unoptimized_program, options, output) : 0;
+    print_output_counts(output);
+    return status;
+}
+
+// Compiles the program in a directory, or a single .jack file.
+int compile_path(fs::path path, const Options& options) {
     if (fs::is_directory(path)) {
-        cout << "Input is a directory: " << path << endl;
+        LOG_INFO("Input is a directory: " << path);
         vector<fs::path> paths;
+        vector<fs::path> library_paths;
         for (const auto& entry : fs::directory_iterator(path)) {
             if (entry.path().extension() == INPUT_TYPE) {
-                cout << "Found valid file: " << entry.path().filename() << '\n';
+                LOG_DEBUG("Found valid file: " << entry.path().filename());
                 paths.push_back(entry.path());
             }
         }
-        for (const auto& path : paths) {
-            to_file(path);
+        // .vm/.vmb files without a .jack source (e.g. the OS) are linked as they are
+        for (const auto& entry : fs::directory_iterator(path)) {
+            fs::path source = entry.path();
+            source.replace_extension(INPUT_TYPE);
+            bool is_vm_file = entry.path().extension() == OUTPUT_TYPE || entry.path().extension() == BYTECODE_TYPE;
+            if (is_vm_file && !fs::exists(source)) {
+                library_paths.push_back(entry.path());
+            }
         }
+        return compile_program(paths, library_paths, path / fs::canonical(path).filename(), options);
     } else if (fs::is_regular_file(path) && path.extension() == INPUT_TYPE) {
-        cout << "Input is a single file: " << path.filename() << '\n';
-        to_file(path);
+        LOG_INFO("Input is a single file: " << path.filename());
+        return compile_program({path}, {}, path.parent_path() / path.stem(), options);
     } else {
-        cout << "Invalid argument: " << path << '\n';
-        cout << flush;
+        LOG_ERROR("Invalid argument: " << path);
         return 1;
     }
+}
 
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        Log::flush();
+        cout << USAGE << flush;
+        return 1;
+    }
+    Log::set_level(options.log_level);
+
+    if (options.batch) {
+        vector<fs::path> roots = options.inputs;
+        if (!options.manifest.empty() && !read_manifest(options.manifest, roots)) {
+            Log::flush();
+            cout << flush;
+            return 1;
+        }
+        vector<fs::path> projects = discover_projects(roots, INPUT_TYPE);
+        Log::flush();
+        int status = run_batch(projects, options.jobs, [&options](const fs::path& project) {
+            int status = compile_path(project, options);
+            Log::flush();
+            return status;
+        });
+        cout << flush;
+        return status;
+    }
+
+    fs::path path = options.input;
+    if (path.string().back() == fs::path::preferred_separator) {
+        path = path.parent_path();
+    }
+
+    if (options.bytecode_to_text) {
+        int status = bytecode_to_text(path);
+        Log::flush();
+        cout << flush;
+        return status;
+    }
+
+    int status = compile_path(path, options);
+    Log::flush();
     cout << flush;
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
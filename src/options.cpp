@@ -0,0 +1,189 @@
+#ifndef OPTIONS_CPP
+#define OPTIONS_CPP
+
+#include "constants.h"
+#include "log.cpp"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+
+using namespace std;
+namespace fs = filesystem;
+
+struct Options {
+    fs::path input;
+    vector<fs::path> inputs;
+    bool batch = false;
+    fs::path manifest;
+    int jobs = 0;
+    bool inline_functions = false;
+    int inline_budget = DEFAULT_INLINE_BUDGET;
+    int optimization_level = DEFAULT_OPTIMIZATION_LEVEL;
+    bool passes_given = false;
+    vector<string> passes;
+    vector<string> disabled_passes;
+    bool time_passes = false;
+    bool intern_strings = false;
+    bool emit_asm = false;
+    bool emit_hack = false;
+    bool optimize_asm = false;
+    bool emit_bytecode = false;
+    bool bytecode_to_text = false;
+    bool bootstrap = false;
+    bool report = false;
+    bool run = false;
+    int max_steps = DEFAULT_MAX_STEPS;
+    fs::path profile_gen;
+    fs::path profile_use;
+    int max_errors = DEFAULT_MAX_ERRORS;
+    bool json_diagnostics = false;
+    bool incremental = false;
+    LogLevel log_level = LogLevel::INFO;
+};
+
+static const string USAGE =
+    "Usage: jackc [options] <file.jack | directory>\n"
+    "       jackc --vmb-to-vm <file.vmb | directory>\n"
+    "       jackc --batch [options] <root...> | --manifest=FILE\n"
+    "Options:\n"
+    "  --inline              inline small non-recursive subroutines\n"
+    "  --inline-budget=N     largest callee body to inline, in VM commands\n"
+    "  --no-intrinsics       call Memory.peek/poke and Math.abs/min/max instead of inlining them\n"
+    "  --intern-strings      build each string literal once; literals must not be changed\n"
+    "  -O0, -O1, -O2         optimization level (default -O1); -O2 adds --inline and --optimize-asm\n"
+    "  --passes=P,Q,...      run exactly these optimization passes\n"
+    "  --disable-pass=P      do not run pass P\n"
+    "  --time-passes         print the time and VM command change of every pass\n"
+    "  --asm                 also translate the program to a single .asm file\n"
+    "  --hack                like --asm, and assemble it to a .hack file\n"
+    "  --bootstrap           start the .asm image with SP=256 and call Sys.init\n"
+    "  --optimize-asm        keep the stack top in D and fuse commands in the .asm\n"
+    "  --vmb                 write binary VM bytecode (.vmb) instead of .vm text\n"
+    "  --vmb-to-vm           convert .vmb files back to .vm text\n"
+    "  --report              print the static cost of every subroutine and class\n"
+    "  --run                 run the compiled program in the built-in VM interpreter\n"
+    "  --max-steps=N         stop --run after about N executed VM commands\n"
+    "  --profile-gen=FILE    like --run, and write an execution profile to FILE\n"
+    "  --profile-use=FILE    use a profile to guide inlining, function and branch layout\n"
+    "  --batch               compile every directory with .jack files under the roots\n"
+    "  --manifest=FILE       like --batch, with the roots listed in FILE\n"
+    "  --jobs=N              compile N programs at a time in batch mode\n"
+    "  --incremental         keep .jif interface files and reuse unchanged classes\n"
+    "  --max-errors=N        stop after N errors (0 for no limit, default 20)\n"
+    "  --error-format=FMT    report errors as text (default) or json lines on stderr\n"
+    "  -q, --quiet           only print errors and warnings\n"
+    "  -v, --verbose         also print debug messages, such as symbol tables\n";
+
+bool parse_int_option(const string& arg, const string& name, int& value) {
+    if (arg.rfind(name + "=", 0) != 0) return false;
+    try {
+        value = stoi(arg.substr(name.length() + 1));
+    } catch (const exception&) {
+        LOG_ERROR("Invalid value for " << name << ": " << arg);
+        value = -1;
+    }
+    return true;
+}
+
+bool parse_path_option(const string& arg, const string& name, fs::path& value) {
+    if (arg.rfind(name + "=", 0) != 0) return false;
+    value = arg.substr(name.length() + 1);
+    return true;
+}
+
+vector<string> split_list(const string& list) {
+    vector<string> items;
+    stringstream input(list);
+    string item;
+    while (getline(input, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parse_options(int argc, char *argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--inline") {
+            options.inline_functions = true;
+        } else if (parse_int_option(arg, "--inline-budget", options.inline_budget)) {
+            if (options.inline_budget < 0) return false;
+        } else if (arg == "--no-intrinsics") {
+            options.disabled_passes.push_back("intrinsics");
+        } else if (arg == "--intern-strings") {
+            options.intern_strings = true;
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            options.optimization_level = arg[2] - '0';
+        } else if (arg.rfind("--passes=", 0) == 0) {
+            options.passes_given = true;
+            options.passes = split_list(arg.substr(arg.find('=') + 1));
+        } else if (arg.rfind("--disable-pass=", 0) == 0) {
+            for (const auto& pass : split_list(arg.substr(arg.find('=') + 1))) {
+                options.disabled_passes.push_back(pass);
+            }
+        } else if (arg == "--time-passes") {
+            options.time_passes = true;
+        } else if (arg == "--asm") {
+            options.emit_asm = true;
+        } else if (arg == "--hack") {
+            options.emit_asm = true;
+            options.emit_hack = true;
+        } else if (arg == "--bootstrap") {
+            options.bootstrap = true;
+        } else if (arg == "--optimize-asm") {
+            options.optimize_asm = true;
+        } else if (arg == "--vmb") {
+            options.emit_bytecode = true;
+        } else if (arg == "--vmb-to-vm") {
+            options.bytecode_to_text = true;
+        } else if (arg == "--report") {
+            options.report = true;
+        } else if (arg == "--run") {
+            options.run = true;
+        } else if (parse_int_option(arg, "--max-steps", options.max_steps)) {
+            if (options.max_steps < 0) return false;
+        } else if (parse_path_option(arg, "--profile-gen", options.profile_gen)) {
+            options.run = true;
+        } else if (parse_path_option(arg, "--profile-use", options.profile_use)) {
+            continue;
+        } else if (arg == "--batch") {
+            options.batch = true;
+        } else if (parse_path_option(arg, "--manifest", options.manifest)) {
+            options.batch = true;
+        } else if (parse_int_option(arg, "--jobs", options.jobs)) {
+            if (options.jobs < 0) return false;
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (parse_int_option(arg, "--max-errors", options.max_errors)) {
+            if (options.max_errors < 0) return false;
+        } else if (arg == "--error-format=text" || arg == "--error-format=json") {
+            options.json_diagnostics = arg == "--error-format=json";
+        } else if (arg == "-q" || arg == "--quiet") {
+            options.log_level = LogLevel::WARN;
+        } else if (arg == "-v" || arg == "--verbose") {
+            options.log_level = LogLevel::DEBUG;
+        } else if (arg.rfind("-", 0) == 0) {
+            LOG_ERROR("Unknown option: " << arg);
+            return false;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.optimization_level >= 2) {
+        options.optimize_asm = true;
+    }
+    if (options.batch) {
+        return !options.inputs.empty() || !options.manifest.empty();
+    }
+    if (options.inputs.size() > 1) {
+        LOG_ERROR("Unexpected argument: " << options.inputs[1].string());
+        return false;
+    }
+    if (options.inputs.empty()) return false;
+    options.input = options.inputs.front();
+    return true;
+}
+
+#endif // OPTIONS_CPP
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef OUTPUT_WRITER_CPP
+#define OUTPUT_WRITER_CPP
+
+#include "log.cpp"
+#include <string>
+#include <thread>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+#include <filesystem>
+#include <system_error>
+
+using namespace std;
+namespace fs = filesystem;
+
+// Writes output files without touching the ones whose contents did not
+// change, so their modification time stays the same and tools that depend on
+// them do not rebuild. A changed file is replaced atomically: the contents
+// go to a temporary file next to it, which is then renamed over it.
+class OutputWriter
+{
+public:
+    int written = 0;
+    int unchanged = 0;
+
+    bool write(const fs::path& path, const string& contents) {
+        if (has_contents(path, contents)) {
+            unchanged++;
+            return true;
+        }
+
+        fs::path temporary = path;
+        temporary += ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+        ofstream output(temporary, ios::binary);
+        if (!output.is_open()) {
+            LOG_ERROR("Failed to open output file: " << path.string());
+            return false;
+        }
+        output.write(contents.data(), contents.size());
+        output.close();
+
+        error_code error;
+        if (output) {
+            fs::rename(temporary, path, error);
+        }
+        if (!output || error) {
+            fs::remove(temporary, error);
+            LOG_ERROR("Failed to write output file: " << path.string());
+            return false;
+        }
+        written++;
+        return true;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+    static bool has_contents(const fs::path& path, const string& contents) {
+        error_code error;
+        uintmax_t size = fs::file_size(path, error);
+        if (error || size != contents.size()) return false;
+
+        ifstream input(path, ios::binary);
+        char buffer[CHUNK_SIZE];
+        for (size_t offset = 0; offset < contents.size(); offset += CHUNK_SIZE) {
+            size_t length = min(CHUNK_SIZE, contents.size() - offset);
+            if (!input.read(buffer, length) || memcmp(buffer, contents.data() + offset, length) != 0) return false;
+        }
+        return true;
+    }
+
+};
+
+#endif // OUTPUT_WRITER_CPP
\ No newline at end of file
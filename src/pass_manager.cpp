@@ -0,0 +1,180 @@
+#ifndef PASS_MANAGER_CPP
+#define PASS_MANAGER_CPP
+
+#include "log.cpp"
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+
+using namespace std;
+
+// The passes each -O level runs. Passes that options such as --inline or
+// --profile-use ask for are added to any level.
+static const vector<vector<string>> OPTIMIZATION_PIPELINES = {
+    {},
+    {"tail-calls", "simplify-cfg", "licm", "cse", "intrinsics", "local-slots"},
+    {"tail-calls", "inline", "simplify-cfg", "licm", "cse", "intrinsics", "local-slots"}
+};
+
+enum class IrLevel {
+    PROGRAM,
+    FUNCTION
+};
+
+// An optimization pass over the VM code. A program pass sees the whole
+// program at once; a function pass is run on every function by itself.
+// dependencies are the passes that have to run before this one when both are
+// in the pipeline.
+struct Pass {
+    string name;
+    IrLevel level;
+    vector<string> dependencies;
+    function<void(VmProgram&)> run_program;
+    function<void(VmFunction&)> run_function;
+};
+
+struct PassTiming {
+    string name;
+    IrLevel level;
+    double milliseconds;
+    long long commands_before;
+    long long commands_after;
+};
+
+// Runs the enabled passes over a program in dependency order (passes that do
+// not depend on each other run in the order they were added) and records how
+// long each took and how it changed the number of VM commands.
+class PassManager
+{
+public:
+    void add(Pass pass) {
+        passes.push_back(pass);
+    }
+
+    bool has_pass(const string& name) const {
+        return index_of(name) >= 0;
+    }
+
+    string pass_names() const {
+        string names;
+        for (const auto& pass : passes) {
+            names += (names.empty() ? "" : ", ") + pass.name;
+        }
+        return names;
+    }
+
+    void enable(const string& name) {
+        enabled[name] = true;
+    }
+
+    void disable(const string& name) {
+        enabled[name] = false;
+    }
+
+    void disable_all() {
+        enabled.clear();
+    }
+
+    bool is_enabled(const string& name) const {
+        auto entry = enabled.find(name);
+        return entry != enabled.end() && entry->second;
+    }
+
+    // Passes that will run, in order, or an empty list and false if their
+    // dependencies form a cycle.
+    bool pipeline(vector<const Pass*>& order) const {
+        order.clear();
+        vector<bool> done(passes.size(), false);
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            for (size_t i = 0; i < passes.size(); i++) {
+                if (done[i] || !is_enabled(passes[i].name)) continue;
+                bool ready = true;
+                for (const auto& dependency : passes[i].dependencies) {
+                    int k = index_of(dependency);
+                    if (k >= 0 && is_enabled(dependency) && !done[k]) ready = false;
+                }
+                if (!ready) continue;
+                done[i] = true;
+                order.push_back(&passes[i]);
+                progress = true;
+                break;
+            }
+        }
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (!done[i] && is_enabled(passes[i].name)) {
+                LOG_ERROR("Passes depend on each other in a cycle: " << passes[i].name);
+                order.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool run(VmProgram& program) {
+        vector<const Pass*> order;
+        if (!pipeline(order)) return false;
+
+        timings.clear();
+        for (const Pass* pass : order) {
+            long long before = command_count(program);
+            auto start = chrono::steady_clock::now();
+            if (pass->level == IrLevel::PROGRAM) {
+                pass->run_program(program);
+            } else {
+                for (auto& vm_class : program.classes) {
+                    for (auto& function : vm_class.functions) {
+                        pass->run_function(function);
+                    }
+                }
+            }
+            chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+            timings.push_back({pass->name, pass->level, elapsed.count(), before, command_count(program)});
+        }
+        return true;
+    }
+
+    void print_timings(ostream& output) const {
+        output << left << setw(18) << "Pass" << setw(10) << "Level" << right << setw(12) << "Time"
+               << setw(21) << "VM commands" << '\n';
+        for (const auto& timing : timings) {
+            long long change = timing.commands_after - timing.commands_before;
+            output << left << setw(18) << timing.name << setw(10)
+                   << (timing.level == IrLevel::PROGRAM ? "program" : "function") << right
+                   << setw(9) << fixed << setprecision(2) << timing.milliseconds << " ms"
+                   << setw(10) << timing.commands_before << " -> " << setw(7) << timing.commands_after
+                   << " (" << (change > 0 ? "+" : "") << change << ")" << '\n';
+        }
+    }
+
+private:
+    vector<Pass> passes;
+    unordered_map<string, bool> enabled;
+    vector<PassTiming> timings;
+
+    int index_of(const string& name) const {
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (passes[i].name == name) return i;
+        }
+        return -1;
+    }
+
+    static long long command_count(const VmProgram& program) {
+        long long count = 0;
+        for (const auto& vm_class : program.classes) {
+            for (const auto& function : vm_class.functions) {
+                count += function.body.size() + 1;
+            }
+        }
+        return count;
+    }
+
+};
+
+#endif // PASS_MANAGER_CPP
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef PASSES_CPP
+#define PASSES_CPP
+
+#include "options.cpp"
+#include "profile.cpp"
+#include "pass_manager.cpp"
+#include "inliner.cpp"
+#include "string_pool.cpp"
+#include "cfg.cpp"
+#include "cse.cpp"
+#include "local_slots.cpp"
+#include "tail_calls.cpp"
+#include "intrinsics.cpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+
+using namespace std;
+
+// Adds every optimization pass, wired to the options and profile. libraries
+// are the classes linked into the program after the passes.
+void register_passes(PassManager& passes, const Options& options, const Profile* profile, const VmProgram& libraries) {
+    passes.add({"tail-calls", IrLevel::FUNCTION, {}, nullptr, [](VmFunction& function) {
+        eliminate_tail_calls(function);
+    }});
+    passes.add({"inline", IrLevel::PROGRAM, {"tail-calls"}, [&options, profile](VmProgram& program) {
+        Inliner inliner(program, options.inline_budget, profile);
+        int inlined_count = inliner.run();
+        LOG_INFO("Inlined " << inlined_count << " call sites.");
+    }, nullptr});
+    passes.add({"intern-strings", IrLevel::PROGRAM, {"inline"}, [&libraries](VmProgram& program) {
+        StringPool pool(program, libraries);
+        int interned_count = pool.run();
+        LOG_INFO("Interned " << interned_count << " string literals.");
+    }, nullptr});
+    passes.add({"simplify-cfg", IrLevel::FUNCTION, {"tail-calls", "inline", "intern-strings"}, nullptr, [](VmFunction& function) {
+        simplify_control_flow(function);
+    }});
+    // program passes only to tell the OS Math functions from a Math class of
+    // the program
+    passes.add({"licm", IrLevel::PROGRAM, {"simplify-cfg"}, [](VmProgram& program) {
+        unordered_set<string> program_classes = defined_classes(program);
+        for (auto& vm_class : program.classes) {
+            for (auto& function : vm_class.functions) {
+                ExpressionCache(function, program_classes).hoist_loop_invariants();
+            }
+        }
+    }, nullptr});
+    passes.add({"cse", IrLevel::PROGRAM, {"simplify-cfg", "licm"}, [](VmProgram& program) {
+        unordered_set<string> program_classes = defined_classes(program);
+        for (auto& vm_class : program.classes) {
+            for (auto& function : vm_class.functions) {
+                ExpressionCache(function, program_classes).eliminate_common_subexpressions();
+            }
+        }
+    }, nullptr});
+    passes.add({"intrinsics", IrLevel::PROGRAM, {"inline", "licm", "cse"}, [](VmProgram& program) {
+        expand_intrinsics(program);
+    }, nullptr});
+    passes.add({"local-slots", IrLevel::FUNCTION, {"tail-calls", "inline", "simplify-cfg", "licm", "cse", "intrinsics"}, nullptr, [](VmFunction& function) {
+        reuse_local_slots(function);
+    }});
+    passes.add({"function-layout", IrLevel::PROGRAM, {"inline", "intern-strings"}, [&options, profile](VmProgram& program) {
+        apply_function_layout(program, *profile, !options.bootstrap);
+    }, nullptr});
+}
+
+// Enables the passes of the -O level, or those given with --passes, and the
+// ones other options ask for, except those given with --disable-pass.
+bool select_passes(PassManager& passes, const Options& options, const Profile* profile) {
+    vector<string> selected = options.passes_given ? options.passes : OPTIMIZATION_PIPELINES[options.optimization_level];
+    if (options.inline_functions) selected.push_back("inline");
+    if (options.intern_strings) selected.push_back("intern-strings");
+    if (profile != nullptr) selected.push_back("function-layout");
+    for (const auto& name : selected) {
+        passes.enable(name);
+    }
+    for (const auto& name : options.disabled_passes) {
+        passes.disable(name);
+    }
+
+    selected.insert(selected.end(), options.disabled_passes.begin(), options.disabled_passes.end());
+    for (const auto& name : selected) {
+        if (!passes.has_pass(name)) {
+            LOG_ERROR("Unknown pass: " << name << " (passes: " << passes.pass_names() << ")");
+            return false;
+        }
+    }
+    if (profile == nullptr && find(options.passes.begin(), options.passes.end(), "function-layout") != options.passes.end()) {
+        LOG_ERROR("Pass function-layout needs --profile-use");
+        return false;
+    }
+    return true;
+}
+
+#endif // PASSES_CPP
\ No newline at end of file
@@ -0,0 +1,170 @@
+#ifndef PROFILE_CPP
+#define PROFILE_CPP
+
+#include "log.cpp"
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+struct BranchCounts {
+    long long taken = 0;
+    long long executed = 0;
+};
+
+// Execution profile of a program, as collected by `jackc --run --profile-gen`.
+// The text format has one record per line:
+//
+//   function <name> <calls>
+//   call <caller> <callee> <count>
+//   branch <function> <label> <taken> <executed>
+//
+// where a branch is an if-goto and label is its target, e.g. IF_TRUE0 or
+// WHILE_END1 as generated by the compiler. Profiles are collected on the code
+// as the compiler wrote it, before the optimization passes rename, merge or
+// inline its labels and calls, so the records name the if and while
+// statements and calls of the source.
+class Profile
+{
+public:
+    unordered_map<string, long long> function_calls;
+    unordered_map<string, long long> call_edges;
+    unordered_map<string, BranchCounts> branches;
+
+    long long calls_of(const string& function) const {
+        auto entry = function_calls.find(function);
+        return entry == function_calls.end() ? 0 : entry->second;
+    }
+
+    long long edge_count(const string& caller, const string& callee) const {
+        auto entry = call_edges.find(caller + " " + callee);
+        return entry == call_edges.end() ? 0 : entry->second;
+    }
+
+    long long total_calls() const {
+        long long total = 0;
+        for (const auto& entry : function_calls) total += entry.second;
+        return total;
+    }
+
+    // Probability that the condition of if statement `label_count` in
+    // `function` is true, or -1 if it never ran. The if-goto targets
+    // IF_TRUE<n> or, when it was laid out with the true path falling
+    // through, IF_FALSE<n>.
+    double if_true_probability(const string& function, int label_count) const {
+        string suffix = to_string(label_count);
+        return true_probability(function, "IF_TRUE" + suffix, "IF_FALSE" + suffix);
+    }
+
+    // Probability that the condition of while statement `label_count` in
+    // `function` is true each time it is tested, or -1 if it never ran. The
+    // if-goto leaves the loop at WHILE_END<n> or, when the loop was laid out
+    // with the test at the bottom, goes back to WHILE_BODY<n>.
+    double while_true_probability(const string& function, int label_count) const {
+        string suffix = to_string(label_count);
+        return true_probability(function, "WHILE_BODY" + suffix, "WHILE_END" + suffix);
+    }
+
+    bool load(istream& input) {
+        string line;
+        int line_number = 0;
+        while (getline(input, line)) {
+            line_number++;
+            istringstream fields(line);
+            string kind;
+            if (!(fields >> kind) || kind.front() == '#') continue;
+
+            bool valid;
+            if (kind == "function") {
+                string name;
+                long long count;
+                valid = static_cast<bool>(fields >> name >> count);
+                if (valid) function_calls[name] += count;
+            } else if (kind == "call") {
+                string caller, callee;
+                long long count;
+                valid = static_cast<bool>(fields >> caller >> callee >> count);
+                if (valid) call_edges[caller + " " + callee] += count;
+            } else if (kind == "branch") {
+                string function, label;
+                BranchCounts counts;
+                valid = static_cast<bool>(fields >> function >> label >> counts.taken >> counts.executed);
+                if (valid) {
+                    BranchCounts& total = branches[function + "$" + label];
+                    total.taken += counts.taken;
+                    total.executed += counts.executed;
+                }
+            } else {
+                valid = false;
+            }
+            if (!valid) {
+                LOG_ERROR("Invalid profile record on line " << line_number << ": " << line);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void save(ostream& output) const {
+        for (const auto& entry : sorted(function_calls)) {
+            output << "function " << entry.first << ' ' << entry.second << '\n';
+        }
+        for (const auto& entry : sorted(call_edges)) {
+            output << "call " << entry.first << ' ' << entry.second << '\n';
+        }
+        for (const auto& entry : sorted(branches)) {
+            string key = entry.first;
+            auto separator = key.find('$');
+            output << "branch " << key.substr(0, separator) << ' ' << key.substr(separator + 1) << ' '
+                   << entry.second.taken << ' ' << entry.second.executed << '\n';
+        }
+    }
+
+private:
+    // Probability that a condition is true given the if-goto that jumps to
+    // true_label when it is, or the one that jumps to false_label when it is
+    // not, whichever the function has.
+    double true_probability(const string& function, const string& true_label, const string& false_label) const {
+        auto entry = branches.find(function + "$" + true_label);
+        if (entry != branches.end() && entry->second.executed > 0) {
+            return (double)entry->second.taken / entry->second.executed;
+        }
+        entry = branches.find(function + "$" + false_label);
+        if (entry != branches.end() && entry->second.executed > 0) {
+            return 1 - (double)entry->second.taken / entry->second.executed;
+        }
+        return -1;
+    }
+
+    template <typename T>
+    static vector<pair<string, T>> sorted(const unordered_map<string, T>& map) {
+        vector<pair<string, T>> entries(map.begin(), map.end());
+        sort(entries.begin(), entries.end(), [](const pair<string, T>& a, const pair<string, T>& b) {
+            return a.first < b.first;
+        });
+        return entries;
+    }
+
+};
+
+// Orders the functions of every class by how often they were called, so hot
+// code ends up next to each other in the image. Functions that never ran keep
+// their relative order at the end. With keep_entry the first function of the
+// program stays in place, for images that start executing at address 0.
+void apply_function_layout(VmProgram& program, const Profile& profile, bool keep_entry) {
+    for (size_t i = 0; i < program.classes.size(); i++) {
+        auto& functions = program.classes[i].functions;
+        auto first = functions.begin();
+        if (keep_entry && i == 0 && first != functions.end()) first++;
+        stable_sort(first, functions.end(), [&profile](const VmFunction& a, const VmFunction& b) {
+            return profile.calls_of(a.name) > profile.calls_of(b.name);
+        });
+    }
+}
+
+#endif // PROFILE_CPP
\ No newline at end of file
@@ -0,0 +1,162 @@
+#ifndef REPORT_CPP
+#define REPORT_CPP
+
+#include "vm_code.cpp"
+#include "hack_backend.cpp"
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+static const int ROM_SIZE = 32768;
+
+struct OpcodeCost {
+    int count = 0;
+    int size = 0;
+    long long cycles = 0;
+};
+
+// Static cost of one function, counted over its VM commands without running
+// anything. size is the Hack instructions it takes in the image with the
+// chosen lowering; cycles is the cost of executing every command once with
+// the plain lowering, calls and comparisons including their trampoline.
+struct FunctionCost {
+    string name;
+    int vm_commands = 0;
+    int size = 0;
+    long long cycles = 0;
+    int max_stack_depth = 0;
+    int multiplies = 0;
+    int divides = 0;
+    int string_allocations = 0;
+    vector<OpcodeCost> opcodes = vector<OpcodeCost>(static_cast<int>(VmOp::RETURN) + 1);
+};
+
+// Deepest the operand stack of a function gets above its locals, following
+// every path through the body. Returns -1 if paths reach a label with
+// different depths.
+int max_stack_depth(const VmFunction& function) {
+    const vector<VmInstruction>& body = function.body;
+    unordered_map<string, size_t> labels;
+    for (size_t i = 0; i < body.size(); i++) {
+        if (body[i].op == VmOp::LABEL) labels[body[i].name] = i;
+    }
+
+    vector<int> depth_at(body.size() + 1, -1);
+    vector<size_t> work;
+    auto reach = [&](size_t i, int depth) {
+        if (depth_at[i] < 0) {
+            depth_at[i] = depth;
+            work.push_back(i);
+        }
+        return depth_at[i] == depth;
+    };
+
+    int max_depth = 0;
+    bool consistent = reach(0, 0);
+    while (!work.empty()) {
+        size_t i = work.back();
+        work.pop_back();
+        if (i == body.size()) continue;
+
+        const VmInstruction& instruction = body[i];
+        int depth = depth_at[i];
+        switch (instruction.op) {
+            case VmOp::PUSH:
+                depth++;
+                break;
+            case VmOp::NEG:
+            case VmOp::NOT:
+            case VmOp::LABEL:
+            case VmOp::GOTO:
+            case VmOp::FUNCTION:
+                break;
+            case VmOp::CALL:
+                depth += 1 - instruction.index;
+                break;
+            default:
+                depth--;
+                break;
+        }
+        max_depth = max(max_depth, depth);
+
+        if (instruction.is_jump() && labels.count(instruction.name) > 0) {
+            consistent = reach(labels[instruction.name], depth) && consistent;
+        }
+        if (instruction.op != VmOp::GOTO && instruction.op != VmOp::RETURN) {
+            consistent = reach(i + 1, depth) && consistent;
+        }
+    }
+    return consistent ? max_depth : -1;
+}
+
+FunctionCost function_cost(const VmFunction& function, HackBackend& backend) {
+    FunctionCost cost;
+    cost.name = function.name;
+    cost.vm_commands = function.body.size() + 1;
+    cost.size = backend.function_size(function);
+    cost.max_stack_depth = max_stack_depth(function);
+
+    VmInstruction entry = {VmOp::FUNCTION, Segment::NONE, function.n_locals, function.name};
+    vector<const VmInstruction*> instructions = {&entry};
+    for (const auto& instruction : function.body) {
+        instructions.push_back(&instruction);
+    }
+    for (const VmInstruction* instruction : instructions) {
+        OpcodeCost& opcode = cost.opcodes[static_cast<int>(instruction->op)];
+        int cycles = backend.estimate_cycles(*instruction);
+        opcode.count++;
+        opcode.size += backend.estimate_size(*instruction);
+        opcode.cycles += cycles;
+        cost.cycles += cycles;
+
+        if (instruction->op != VmOp::CALL) continue;
+        if (instruction->name == "Math.multiply") cost.multiplies++;
+        if (instruction->name == "Math.divide") cost.divides++;
+        if (instruction->name == "String.new") cost.string_allocations++;
+    }
+    return cost;
+}
+
+// Prints the static cost of every function of the program and the ROM each
+// class takes. Sizes are for the lowering chosen with bootstrap and optimize;
+// opcode sizes are for the plain lowering.
+void write_report(const VmProgram& program, bool bootstrap, bool optimize, ostream& output) {
+    HackBackend backend(bootstrap, optimize);
+    for (const auto& vm_class : program.classes) {
+        int class_size = 0;
+        for (const auto& function : vm_class.functions) {
+            FunctionCost cost = function_cost(function, backend);
+            class_size += cost.size;
+
+            output << cost.name << ": " << cost.vm_commands << " VM commands, " << cost.size
+                   << " Hack instructions, ~" << cost.cycles << " cycles, stack depth ";
+            if (cost.max_stack_depth >= 0) {
+                output << cost.max_stack_depth;
+            } else {
+                output << "unknown";
+            }
+            output << ", " << cost.multiplies << " multiply, " << cost.divides << " divide, "
+                   << cost.string_allocations << " string allocations" << '\n';
+
+            for (size_t op = 0; op < cost.opcodes.size(); op++) {
+                const OpcodeCost& opcode = cost.opcodes[op];
+                if (opcode.count == 0) continue;
+                output << "    " << left << setw(9) << VM_OP_NAMES[op] << right
+                       << setw(6) << opcode.count << " commands" << setw(7) << opcode.size << " Hack"
+                       << setw(9) << opcode.cycles << " cycles" << '\n';
+            }
+        }
+        output << "Class " << vm_class.name << ": " << class_size << " ROM words" << '\n';
+    }
+
+    int image_size = HackBackend::instruction_count(backend.translate(program));
+    output << "Image: " << image_size << " of " << ROM_SIZE << " ROM words";
+    if (image_size > ROM_SIZE) output << " (too large)";
+    output << '\n';
+}
+
+#endif // REPORT_CPP
\ No newline at end of file
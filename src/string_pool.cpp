@@ -0,0 +1,163 @@
+#ifndef STRING_POOL_CPP
+#define STRING_POOL_CPP
+
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+static const string STRING_INITIALIZER = "$strings";
+static const string ENTRY_FUNCTION = "Main.main";
+
+// Static variables live at RAM[16..255]. Interning stops once the compiled
+// and linked classes use this many of them, which leaves the rest to the OS.
+static const int STRING_STATIC_LIMIT = 200;
+
+// Builds every distinct string literal of a class once and keeps it in a
+// static variable of the class. The literals are constructed by a generated
+// Class.$strings function that Main.main calls before anything else; uses of
+// a literal become a single push static. Since all uses of a literal share
+// one String, programs that change or dispose a literal must not use this.
+class StringPool
+{
+public:
+    // libraries are the classes that are linked into the program as they
+    // are; their statics share RAM with those of the program.
+    StringPool(VmProgram& program, const VmProgram& libraries) {
+        this->program = &program;
+        this->libraries = &libraries;
+    }
+
+    // Returns the number of literal uses replaced, or 0 if the program has no
+    // Main.main to run the initializers from.
+    int run() {
+        if (program->find_function(ENTRY_FUNCTION) == nullptr) return 0;
+
+        int static_count = 0;
+        for (const auto& vm_class : program->classes) {
+            static_count += statics_of(vm_class);
+        }
+        for (const auto& vm_class : libraries->classes) {
+            static_count += statics_of(vm_class);
+        }
+
+        int replaced = 0;
+        vector<string> initializers;
+        for (auto& vm_class : program->classes) {
+            int first_slot = statics_of(vm_class);
+            vector<string> literals;
+            unordered_map<string, int> slots;
+            for (auto& function : vm_class.functions) {
+                vector<VmInstruction> body;
+                for (size_t i = 0; i < function.body.size(); i++) {
+                    string literal;
+                    size_t length = match_literal(function.body, i, literal);
+                    if (length == 0) {
+                        body.push_back(function.body[i]);
+                        continue;
+                    }
+                    if (slots.count(literal) == 0) {
+                        if (static_count >= STRING_STATIC_LIMIT) {
+                            body.insert(body.end(), function.body.begin() + i, function.body.begin() + i + length);
+                            i += length - 1;
+                            continue;
+                        }
+                        slots[literal] = first_slot + literals.size();
+                        literals.push_back(literal);
+                        static_count++;
+                    }
+                    body.push_back(VmInstruction::push(Segment::STATIC, slots[literal]));
+                    i += length - 1;
+                    replaced++;
+                }
+                function.body = body;
+            }
+            if (!literals.empty()) {
+                vm_class.functions.push_back(initializer(vm_class.name, literals, first_slot));
+                initializers.push_back(vm_class.functions.back().name);
+            }
+        }
+
+        // looked up again, adding the initializers may have moved it
+        VmFunction* entry = program->find_function(ENTRY_FUNCTION);
+        vector<VmInstruction> prologue;
+        for (const auto& name : initializers) {
+            prologue.push_back(VmInstruction::call(name, 0));
+            prologue.push_back(VmInstruction::pop(Segment::TEMP, 0));
+        }
+        entry->body.insert(entry->body.begin(), prologue.begin(), prologue.end());
+        return replaced;
+    }
+
+private:
+    VmProgram* program;
+    const VmProgram* libraries;
+
+    // Static slots a class takes: those it declares, and any above them its
+    // code uses (VM text does not say how many it declares).
+    static int statics_of(const VmClass& vm_class) {
+        int count = max(vm_class.n_statics, 0);
+        for (const auto& function : vm_class.functions) {
+            for (const auto& instruction : function.body) {
+                if (instruction.segment == Segment::STATIC) {
+                    count = max(count, instruction.index + 1);
+                }
+            }
+        }
+        return count;
+    }
+
+    // Matches the code the compiler writes for a string literal at body[i]:
+    // push constant n; call String.new 1; then n times push constant c; call
+    // String.appendChar 2. Returns its length and the literal, or 0. Only a
+    // String.new marked as a literal matches: a String.new(0) in the source
+    // makes a string the program owns and may dispose.
+    static size_t match_literal(const vector<VmInstruction>& body, size_t i, string& literal) {
+        if (i + 1 >= body.size() || !is_constant(body[i])) return 0;
+        if (!is_call(body[i + 1], "String.new", 1) || !body[i + 1].literal) return 0;
+        size_t length = body[i].index;
+        if (i + 2 + 2 * length > body.size()) return 0;
+
+        literal.clear();
+        for (size_t k = 0; k < length; k++) {
+            const VmInstruction& character = body[i + 2 + 2 * k];
+            if (!is_constant(character)) return 0;
+            if (!is_call(body[i + 3 + 2 * k], "String.appendChar", 2)) return 0;
+            literal.push_back(static_cast<char>(character.index));
+        }
+        return 2 + 2 * length;
+    }
+
+    static bool is_constant(const VmInstruction& instruction) {
+        return instruction.op == VmOp::PUSH && instruction.segment == Segment::CONSTANT;
+    }
+
+    static bool is_call(const VmInstruction& instruction, const string& name, int n_args) {
+        return instruction.op == VmOp::CALL && instruction.name == name && instruction.index == n_args;
+    }
+
+    static VmFunction initializer(const string& class_name, const vector<string>& literals, int first_slot) {
+        VmFunction function;
+        function.name = class_name + "." + STRING_INITIALIZER;
+        function.n_locals = 0;
+        function.n_args = 0;
+        for (size_t k = 0; k < literals.size(); k++) {
+            function.body.push_back(VmInstruction::push(Segment::CONSTANT, literals[k].length()));
+            function.body.push_back(VmInstruction::call("String.new", 1));
+            for (char c : literals[k]) {
+                function.body.push_back(VmInstruction::push(Segment::CONSTANT, static_cast<int>(c)));
+                function.body.push_back(VmInstruction::call("String.appendChar", 2));
+            }
+            function.body.push_back(VmInstruction::pop(Segment::STATIC, first_slot + k));
+        }
+        function.body.push_back(VmInstruction::push(Segment::CONSTANT, 0));
+        function.body.push_back(VmInstruction::ret());
+        return function;
+    }
+
+};
+
+#endif // STRING_POOL_CPP
\ No newline at end of file
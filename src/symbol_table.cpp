@@ -1,3 +1,5 @@
+#include "log.cpp"
+#include <tuple>
 #include <iostream>
 #include <unordered_map>
 
@@ -28,7 +30,7 @@ public:
             local_vars_count++;
         }
         else {
-            cout << "Error: Kind '" << kind << "' not recognized. Expected 'static', 'field', 'arg' or 'var'." << endl;
+            LOG_ERROR("Error: Kind '" << kind << "' not recognized. Expected 'static', 'field', 'arg' or 'var'.");
             return;
         }
         table[name] = make_tuple(type, kind, index);
@@ -44,7 +46,7 @@ public:
         } else if (kind == "var") {
             return local_vars_count;
         } else {
-            cout << "Error: Kind '" << kind << "' not recognized. Expected 'static', 'field', 'arg' or 'var'." << endl;
+            LOG_ERROR("Error: Kind '" << kind << "' not recognized. Expected 'static', 'field', 'arg' or 'var'.");
             return -1;
         }
     }
@@ -53,8 +55,8 @@ public:
         if (table.count(name) > 0) {
             return get<0>(table[name]);
         } else {
-            cout << "Cannot get type of variable '" << name << "'." << endl;
-            cout << "Variable '" << name << "' not found in symbol table." << endl;
+            LOG_ERROR("Cannot get type of variable '" << name << "'.");
+            LOG_ERROR("Variable '" << name << "' not found in symbol table.");
             return "";
         }
     }
@@ -63,8 +65,8 @@ public:
         if (table.count(name) > 0) {
             return get<1>(table[name]);
         } else {
-            cout << "Cannot get kind of variable '" << name << "'." << endl;
-            cout << "Error: Variable '" << name << "' not found in symbol table." << endl;
+            LOG_ERROR("Cannot get kind of variable '" << name << "'.");
+            LOG_ERROR("Error: Variable '" << name << "' not found in symbol table.");
             return "";
         }
     }
@@ -73,8 +75,8 @@ public:
         if (table.count(name) > 0) {
             return get<2>(table[name]);
         } else {
-            cout << "Cannot get index of variable '" << name << "'." << endl;
-            cout << "Error: Variable '" << name << "' not found in symbol table." << endl;
+            LOG_ERROR("Cannot get index of variable '" << name << "'.");
+            LOG_ERROR("Error: Variable '" << name << "' not found in symbol table.");
             return -1;
         }
     }
@@ -87,17 +89,22 @@ public:
         local_vars_count = 0;
     }
 
-    void print() {
+    void print(ostream& output) const {
         for (const auto& entry : table) {
             string name = entry.first;
             string type = get<0>(entry.second);
             string kind = get<1>(entry.second);
             int index = get<2>(entry.second);
 
-            cout << "Name: " << name << ", Type: " << type << ", Kind: " << kind << ", Index: " << index << endl;
+            output << '\n' << "Name: " << name << ", Type: " << type << ", Kind: " << kind << ", Index: " << index;
         }
     }
 
+    friend ostream& operator<<(ostream& output, const SymbolTable& table) {
+        table.print(output);
+        return output;
+    }
+
     bool contains(string name) {
         return table.find(name) != table.end();
     }
@@ -0,0 +1,48 @@
+#ifndef TAIL_CALLS_CPP
+#define TAIL_CALLS_CPP
+
+#include "vm_code.cpp"
+#include <vector>
+
+using namespace std;
+
+static const string TAIL_CALL_LABEL = "TAIL_CALL";
+
+// Turns calls of a function to itself whose result it returns right away
+// (return f(...) in f) into a jump back to its start: the arguments the call
+// would get are popped into the function's own arguments and its locals are
+// cleared again, as the function command would. The function then runs in
+// constant stack space. For methods and constructors the start includes
+// setting this, so a call on another object of the class works too. Returns
+// the number of calls replaced.
+int eliminate_tail_calls(VmFunction& function) {
+    vector<VmInstruction>& body = function.body;
+    vector<VmInstruction> result;
+    int replaced = 0;
+    for (size_t i = 0; i < body.size(); i++) {
+        const VmInstruction& instruction = body[i];
+        bool is_tail_call = instruction.op == VmOp::CALL && instruction.name == function.name &&
+            instruction.index == function.n_args && i + 1 < body.size() && body[i + 1].op == VmOp::RETURN;
+        if (!is_tail_call) {
+            result.push_back(instruction);
+            continue;
+        }
+        for (int k = function.n_args - 1; k >= 0; k--) {
+            result.push_back(VmInstruction::pop(Segment::ARGUMENT, k));
+        }
+        for (int k = 0; k < function.n_locals; k++) {
+            result.push_back(VmInstruction::push(Segment::CONSTANT, 0));
+            result.push_back(VmInstruction::pop(Segment::LOCAL, k));
+        }
+        result.push_back(VmInstruction::jump(VmOp::GOTO, TAIL_CALL_LABEL));
+        replaced++;
+        i++;
+    }
+    if (replaced > 0) {
+        result.insert(result.begin(), VmInstruction::label(TAIL_CALL_LABEL));
+        body = result;
+    }
+    return replaced;
+}
+
+#endif // TAIL_CALLS_CPP
\ No newline at end of file
@@ -2,107 +2,134 @@
 #define TOKENIZER_CPP
 
 #include "constants.h"
+#include "diagnostics.cpp"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <list>
+#include <vector>
 #include <unordered_map>
 #include <algorithm>
 
 using namespace std;
 
+struct Token {
+    string text;
+    int line;
+    int column;
+};
 
+// Splits a Jack source file into tokens, each with the line and column it
+// starts at. A string constant becomes three tokens: the opening quote, its
+// characters and the closing quote. Malformed input (an unterminated string
+// or comment, a character that is not part of Jack) is reported to
+// diagnostics and skipped. Past the last token, peek() returns an empty
+// string.
 class Tokenizer
 {
 public:
-    Tokenizer(string path)
+    Tokenizer(string path, Diagnostics& diagnostics)
     {
-        input_file.open(path);
+        this->path = path;
+        this->diagnostics = &diagnostics;
         pos = 0;
-        tokenize();
+        ifstream input_file(path);
+        if (!input_file.is_open()) {
+            diagnostics.error(path, 0, 0, "cannot open file");
+            return;
+        }
+        stringstream input;
+        input << input_file.rdbuf();
+        tokenize(input.str());
     }
 
-    void tokenize()
+    // Tokenizes source that is already in memory; path is only used to
+    // report errors.
+    Tokenizer(string path, const string& source, Diagnostics& diagnostics)
     {
-        bool is_multi_line_comment = false;
-        string line;
-        while (getline(input_file, line))
-        {
-            // remove one line comments
-            auto comm_start_pos = line.find(SINGLE_LINE_COMMENT_STR);
-            if (comm_start_pos != NPOS)
-            {
-                line = line.substr(0, comm_start_pos);
-            }
+        this->path = path;
+        this->diagnostics = &diagnostics;
+        pos = 0;
+        tokenize(source);
+    }
 
-            // remove multi line comments
-            comm_start_pos = line.find(MULTI_LINE_COMMENT_START_STR);
-            auto comm_end_pos = line.find(MULTI_LINE_COMMENT_END_STR);
-            if (comm_start_pos != NPOS && comm_end_pos != NPOS)
-            {
-                line.erase(comm_start_pos, comm_end_pos - comm_start_pos + MULTI_LINE_COMMENT_END_STR.length());
-            }
-            else if (comm_start_pos != NPOS && comm_end_pos == NPOS)
-            {
-                line.erase(comm_start_pos);
-                is_multi_line_comment = true;
-                continue;
-            }
-            else if (comm_start_pos == NPOS && comm_end_pos != NPOS)
-            {
-                line.erase(0, comm_end_pos + MULTI_LINE_COMMENT_END_STR.length());
-                is_multi_line_comment = false;
-            }
-            if (is_multi_line_comment)
-                continue;
-
-            // insert spaces around symbols, so they can be tokenized
-            for (char symbol : SYMBOLS)
-            {
-                size_t str_const_start_pos = line.find_first_of("\"");
-                size_t str_const_end_pos = line.find_last_of("\"");
-                size_t pos = 0;
-                while ((pos = line.find(symbol, pos)) != NPOS && (pos <= str_const_start_pos || pos >= str_const_end_pos))
-                {
-                    line.insert(pos, " ");
-                    line.insert(pos + 2, " ");
-                    pos += 3;
-                }
+    void tokenize(const string& source)
+    {
+        int line = 1;
+        int column = 1;
+        size_t i = 0;
+        auto next = [&]() {
+            if (source[i] == '\n') {
+                line++;
+                column = 1;
+            } else {
+                column++;
             }
+            i++;
+        };
 
-            string value;
-            stringstream line_stream(line);
-            while (line_stream >> value)
-            {
-                // handle string constants
-                if (value == "\"") {
-                    tokens.push_back(value);
-                    auto str_const_start_pos = line.find_first_of("\"");
-                    auto str_const_end_pos = line.find_last_of("\"");
-                    string str_const = line.substr(str_const_start_pos + 2, str_const_end_pos - str_const_start_pos - 3);
-                    tokens.push_back(str_const);
-                    while (line_stream >> value && value != "\"");
-                    tokens.push_back(value);
+        while (i < source.size())
+        {
+            char c = source[i];
+            int start_line = line;
+            int start_column = column;
+
+            if (isspace(static_cast<unsigned char>(c))) {
+                next();
+            } else if (source.compare(i, SINGLE_LINE_COMMENT_STR.length(), SINGLE_LINE_COMMENT_STR) == 0) {
+                while (i < source.size() && source[i] != '\n') next();
+            } else if (source.compare(i, MULTI_LINE_COMMENT_START_STR.length(), MULTI_LINE_COMMENT_START_STR) == 0) {
+                size_t end = source.find(MULTI_LINE_COMMENT_END_STR, i + MULTI_LINE_COMMENT_START_STR.length());
+                if (end == NPOS) {
+                    diagnostics->error(path, start_line, start_column, "unterminated comment");
+                    end = source.size();
+                } else {
+                    end += MULTI_LINE_COMMENT_END_STR.length();
+                }
+                while (i < end) next();
+            } else if (c == '"') {
+                tokens.push_back({"\"", start_line, start_column});
+                next();
+                size_t end = source.find_first_of("\"\n", i);
+                if (end == NPOS) end = source.size();
+                tokens.push_back({source.substr(i, end - i), line, column});
+                while (i < end) next();
+                if (i < source.size() && source[i] == '"') {
+                    tokens.push_back({"\"", line, column});
+                    next();
                 } else {
-                    tokens.push_back(value);
+                    diagnostics->error(path, start_line, start_column, "unterminated string constant");
+                    tokens.push_back({"\"", line, column});
                 }
+            } else if (find(SYMBOLS.begin(), SYMBOLS.end(), c) != SYMBOLS.end()) {
+                tokens.push_back({string(1, c), start_line, start_column});
+                next();
+            } else if (isalnum(static_cast<unsigned char>(c)) || c == '_') {
+                size_t start = i;
+                while (i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_')) next();
+                tokens.push_back({source.substr(start, i - start), start_line, start_column});
+            } else {
+                diagnostics->error(path, start_line, start_column, string("unexpected character '") + c + "'");
+                next();
             }
         }
+        end_line = line;
+        end_column = column;
     }
 
     string advance() {
         if (pos < tokens.size()) {
-            return tokens[pos++];
+            return tokens[pos++].text;
         } else {
-            throw runtime_error("No more tokens available.");
+            return "";
         }
     }
 
     string look_ahead(int i) {
         if (pos+i < tokens.size()) {
-            return tokens[pos+i];
+            return tokens[pos+i].text;
         } else {
-            throw runtime_error("Out of range.");
+            return "";
         }
     }
 
@@ -110,19 +137,49 @@ public:
         return look_ahead(0);
     }
 
+    bool at_end() const {
+        return pos >= tokens.size();
+    }
+
+    long unsigned int position() const {
+        return pos;
+    }
+
+    const string& file() const {
+        return path;
+    }
+
+    // line and column of the current token, or of the end of the file
+    int line() const {
+        return at_end() ? end_line : tokens[pos].line;
+    }
+
+    int column() const {
+        return at_end() ? end_column : tokens[pos].column;
+    }
+
+    // Reports an error at the current token, or at the end of the file.
+    void error(const string& message) {
+        diagnostics->error(path, line(), column(), message);
+    }
+
     void save_state() {
-        save_state_pos = pos;
+        saved_positions.push_back(pos);
     }
 
     void restore_state() {
-        pos = save_state_pos;
+        pos = saved_positions.back();
+        saved_positions.pop_back();
     }
 
 private:
-    ifstream input_file;
-    vector<string> tokens;
+    string path;
+    Diagnostics* diagnostics;
+    vector<Token> tokens;
     long unsigned int pos;
-    long unsigned int save_state_pos;
+    vector<long unsigned int> saved_positions;
+    int end_line = 1;
+    int end_column = 1;
 
 };
 
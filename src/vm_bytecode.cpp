@@ -0,0 +1,236 @@
+#ifndef VM_BYTECODE_CPP
+#define VM_BYTECODE_CPP
+
+#include "log.cpp"
+#include "vm_code.cpp"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+// Binary encoding of a VmClass (.vmb), little endian:
+//
+//   header        "JVMB", version u16, string count u16, function count u16,
+//                 instruction count u32, class name u16 (string index),
+//                 statics u16 (0xFFFF if unknown)
+//   strings       length u16 + bytes, for every function, callee and label name
+//   functions     name u16, locals u16, arguments u16 (0xFFFF if unknown),
+//                 first instruction u32, instruction count u32
+//   instructions  opcode u8, segment u8, operand u16
+//
+// The opcode and segment bytes are the VmOp and Segment values. The operand is
+// the index for push/pop and the string index for label, goto, if-goto and
+// call; call keeps its argument count in the segment byte. The opcode of a
+// call marked as the String.new of a string literal has LITERAL_FLAG set.
+static const string BYTECODE_MAGIC = "JVMB";
+static const int BYTECODE_VERSION = 3;
+static const int UNKNOWN_ARGS = 0xFFFF;
+static const int UNKNOWN_STATICS = 0xFFFF;
+static const int LITERAL_FLAG = 0x80;
+
+class BytecodeWriter
+{
+public:
+    bool write(const VmClass& vm_class, ostream& output) {
+        strings.clear();
+        string_indices.clear();
+        bytes.clear();
+
+        int class_name = intern(vm_class.name);
+        size_t instruction_count = 0;
+        for (const auto& function : vm_class.functions) {
+            intern(function.name);
+            for (const auto& instruction : function.body) {
+                if (!instruction.name.empty()) intern(instruction.name);
+                if (instruction.op == VmOp::CALL && instruction.index > 0xFF) {
+                    LOG_ERROR("Call to " << instruction.name << " has too many arguments for bytecode.");
+                    return false;
+                }
+            }
+            instruction_count += function.body.size();
+        }
+        if (strings.size() > 0xFFFF || vm_class.functions.size() > 0xFFFF) {
+            LOG_ERROR("Class " << vm_class.name << " is too large for bytecode.");
+            return false;
+        }
+
+        bytes.insert(bytes.end(), BYTECODE_MAGIC.begin(), BYTECODE_MAGIC.end());
+        u16(BYTECODE_VERSION);
+        u16(strings.size());
+        u16(vm_class.functions.size());
+        u32(instruction_count);
+        u16(class_name);
+        u16(vm_class.n_statics < 0 ? UNKNOWN_STATICS : vm_class.n_statics);
+
+        for (const auto& value : strings) {
+            u16(value.length());
+            bytes.insert(bytes.end(), value.begin(), value.end());
+        }
+
+        size_t first = 0;
+        for (const auto& function : vm_class.functions) {
+            u16(string_indices.at(function.name));
+            u16(function.n_locals);
+            u16(function.n_args < 0 ? UNKNOWN_ARGS : function.n_args);
+            u32(first);
+            u32(function.body.size());
+            first += function.body.size();
+        }
+
+        for (const auto& function : vm_class.functions) {
+            for (const auto& instruction : function.body) {
+                int opcode = static_cast<int>(instruction.op);
+                if (instruction.literal) opcode |= LITERAL_FLAG;
+                bytes.push_back(static_cast<char>(opcode));
+                if (instruction.op == VmOp::CALL) {
+                    bytes.push_back(static_cast<char>(instruction.index));
+                    u16(string_indices.at(instruction.name));
+                } else if (!instruction.name.empty()) {
+                    bytes.push_back(static_cast<char>(Segment::NONE));
+                    u16(string_indices.at(instruction.name));
+                } else {
+                    bytes.push_back(static_cast<char>(instruction.segment));
+                    u16(instruction.index);
+                }
+            }
+        }
+
+        output.write(bytes.data(), bytes.size());
+        return output.good();
+    }
+
+private:
+    vector<string> strings;
+    unordered_map<string, int> string_indices;
+    vector<char> bytes;
+
+    int intern(const string& value) {
+        auto entry = string_indices.find(value);
+        if (entry != string_indices.end()) return entry->second;
+        string_indices[value] = strings.size();
+        strings.push_back(value);
+        return strings.size() - 1;
+    }
+
+    void u16(int value) {
+        bytes.push_back(static_cast<char>(value & 0xFF));
+        bytes.push_back(static_cast<char>((value >> 8) & 0xFF));
+    }
+
+    void u32(size_t value) {
+        u16(value & 0xFFFF);
+        u16((value >> 16) & 0xFFFF);
+    }
+
+};
+
+class BytecodeReader
+{
+public:
+    bool read(istream& input, VmClass& vm_class) {
+        bytes.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+        pos = 0;
+
+        if (bytes.size() < BYTECODE_MAGIC.length() || string(bytes.begin(), bytes.begin() + BYTECODE_MAGIC.length()) != BYTECODE_MAGIC) {
+            return error("not a VM bytecode file");
+        }
+        pos = BYTECODE_MAGIC.length();
+
+        int version = u16();
+        if (version != BYTECODE_VERSION) {
+            return error("unsupported bytecode version " + to_string(version));
+        }
+        int string_count = u16();
+        int function_count = u16();
+        size_t instruction_count = u32();
+        int class_name = u16();
+        int n_statics = u16();
+
+        vector<string> strings;
+        for (int i = 0; i < string_count; i++) {
+            int length = u16();
+            if (pos + length > bytes.size()) return error("truncated string table");
+            strings.push_back(string(bytes.begin() + pos, bytes.begin() + pos + length));
+            pos += length;
+        }
+        if (class_name >= string_count) return error("invalid class name");
+        vm_class.name = strings[class_name];
+        vm_class.n_statics = n_statics == UNKNOWN_STATICS ? -1 : n_statics;
+
+        vector<pair<size_t, size_t>> ranges;
+        for (int i = 0; i < function_count; i++) {
+            int name = u16();
+            int n_locals = u16();
+            int n_args = u16();
+            size_t first = u32();
+            size_t count = u32();
+            if (name >= string_count || first + count > instruction_count) return error("invalid function table");
+            vm_class.functions.push_back({strings[name], n_locals, n_args == UNKNOWN_ARGS ? -1 : n_args, {}});
+            ranges.push_back({first, count});
+        }
+
+        size_t instructions_start = pos;
+        if (instructions_start + instruction_count * 4 > bytes.size()) return error("truncated instructions");
+        for (int i = 0; i < function_count; i++) {
+            pos = instructions_start + ranges[i].first * 4;
+            for (size_t j = 0; j < ranges[i].second; j++) {
+                int op = static_cast<unsigned char>(bytes[pos++]);
+                int segment = static_cast<unsigned char>(bytes[pos++]);
+                int operand = u16();
+                bool literal = (op & LITERAL_FLAG) != 0;
+                op &= ~LITERAL_FLAG;
+                if (op > static_cast<int>(VmOp::RETURN) || op == static_cast<int>(VmOp::FUNCTION)) return error("invalid opcode");
+                if (literal && op != static_cast<int>(VmOp::CALL)) return error("invalid opcode");
+
+                VmInstruction instruction{static_cast<VmOp>(op), Segment::NONE, 0, ""};
+                instruction.literal = literal;
+                bool is_memory_access = instruction.op == VmOp::PUSH || instruction.op == VmOp::POP;
+                if (is_memory_access && (segment == static_cast<int>(Segment::NONE) || segment > static_cast<int>(Segment::TEMP))) {
+                    return error("invalid segment");
+                }
+                if (instruction.op == VmOp::CALL) {
+                    instruction.index = segment;
+                }
+                if (instruction.op == VmOp::CALL || instruction.op == VmOp::LABEL || instruction.is_jump()) {
+                    if (operand >= string_count) return error("invalid string index");
+                    instruction.name = strings[operand];
+                } else if (is_memory_access) {
+                    instruction.segment = static_cast<Segment>(segment);
+                    instruction.index = operand;
+                }
+                vm_class.functions[i].body.push_back(instruction);
+            }
+        }
+        return true;
+    }
+
+private:
+    vector<char> bytes;
+    size_t pos;
+
+    int u16() {
+        if (pos + 2 > bytes.size()) {
+            pos = bytes.size();
+            return 0;
+        }
+        int value = static_cast<unsigned char>(bytes[pos]) | (static_cast<unsigned char>(bytes[pos + 1]) << 8);
+        pos += 2;
+        return value;
+    }
+
+    size_t u32() {
+        size_t low = u16();
+        size_t high = u16();
+        return low | (high << 16);
+    }
+
+    bool error(string message) {
+        LOG_ERROR("Invalid bytecode: " << message);
+        return false;
+    }
+
+};
+
+#endif // VM_BYTECODE_CPP
\ No newline at end of file
@@ -0,0 +1,312 @@
+#ifndef VM_CODE_CPP
+#define VM_CODE_CPP
+
+#include "log.cpp"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+enum class VmOp {
+    PUSH,
+    POP,
+    ADD,
+    SUB,
+    NEG,
+    EQ,
+    GT,
+    LT,
+    AND,
+    OR,
+    NOT,
+    LABEL,
+    GOTO,
+    IF_GOTO,
+    FUNCTION,
+    CALL,
+    RETURN
+};
+
+enum class Segment {
+    NONE,
+    CONSTANT,
+    ARGUMENT,
+    LOCAL,
+    STATIC,
+    THIS,
+    THAT,
+    POINTER,
+    TEMP
+};
+
+static const unordered_map<string, VmOp> ARITHMETIC_OPS = {
+    {"add", VmOp::ADD},
+    {"sub", VmOp::SUB},
+    {"neg", VmOp::NEG},
+    {"eq", VmOp::EQ},
+    {"gt", VmOp::GT},
+    {"lt", VmOp::LT},
+    {"and", VmOp::AND},
+    {"or", VmOp::OR},
+    {"not", VmOp::NOT},
+};
+
+static const unordered_map<string, Segment> SEGMENTS = {
+    {"constant", Segment::CONSTANT},
+    {"argument", Segment::ARGUMENT},
+    {"local", Segment::LOCAL},
+    {"static", Segment::STATIC},
+    {"this", Segment::THIS},
+    {"that", Segment::THAT},
+    {"pointer", Segment::POINTER},
+    {"temp", Segment::TEMP},
+};
+
+static const string VM_OP_NAMES[] = {
+    "push",
+    "pop",
+    "add",
+    "sub",
+    "neg",
+    "eq",
+    "gt",
+    "lt",
+    "and",
+    "or",
+    "not",
+    "label",
+    "goto",
+    "if-goto",
+    "function",
+    "call",
+    "return"
+};
+
+static const string SEGMENT_NAMES[] = {
+    "",
+    "constant",
+    "argument",
+    "local",
+    "static",
+    "this",
+    "that",
+    "pointer",
+    "temp"
+};
+
+// A single VM command. Only the fields used by the command are meaningful:
+// push/pop use segment and index, label/goto/if-goto use name and call uses
+// name and index (the argument count). literal marks the String.new call the
+// compiler writes for a string literal, as opposed to one the program makes.
+struct VmInstruction {
+    VmOp op;
+    Segment segment = Segment::NONE;
+    int index = 0;
+    string name;
+    bool literal = false;
+
+    static VmInstruction push(Segment segment, int index) {
+        return {VmOp::PUSH, segment, index, ""};
+    }
+
+    static VmInstruction pop(Segment segment, int index) {
+        return {VmOp::POP, segment, index, ""};
+    }
+
+    static VmInstruction arithmetic(VmOp op) {
+        return {op, Segment::NONE, 0, ""};
+    }
+
+    static VmInstruction label(string name) {
+        return {VmOp::LABEL, Segment::NONE, 0, name};
+    }
+
+    static VmInstruction jump(VmOp op, string name) {
+        return {op, Segment::NONE, 0, name};
+    }
+
+    static VmInstruction call(string name, int n_args) {
+        return {VmOp::CALL, Segment::NONE, n_args, name};
+    }
+
+    static VmInstruction ret() {
+        return {VmOp::RETURN, Segment::NONE, 0, ""};
+    }
+
+    bool is_arithmetic() const {
+        return op >= VmOp::ADD && op <= VmOp::NOT;
+    }
+
+    bool is_jump() const {
+        return op == VmOp::GOTO || op == VmOp::IF_GOTO;
+    }
+
+    bool is(VmOp op, Segment segment, int index) const {
+        return this->op == op && this->segment == segment && this->index == index;
+    }
+};
+
+// A compiled subroutine. The function command itself is not part of the body;
+// n_args is -1 when the argument count is not known (it is not part of the VM
+// text format).
+struct VmFunction {
+    string name;
+    int n_locals;
+    int n_args = -1;
+    vector<VmInstruction> body;
+};
+
+// n_statics is the number of static variables the class declares, or -1 when
+// it is not known (it is not part of the VM text format either).
+struct VmClass {
+    string name;
+    vector<VmFunction> functions;
+    int n_statics = -1;
+};
+
+struct VmProgram {
+    vector<VmClass> classes;
+
+    VmFunction* find_function(const string& name) {
+        for (auto& vm_class : classes) {
+            for (auto& function : vm_class.functions) {
+                if (function.name == name) return &function;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Class part of a fully qualified subroutine name, e.g. "Main" for "Main.main".
+string class_of(const string& function_name) {
+    return function_name.substr(0, function_name.find('.'));
+}
+
+// Names of the classes compiled from the program. Such a class replaces the
+// OS class of the same name.
+unordered_set<string> defined_classes(const VmProgram& program) {
+    unordered_set<string> names;
+    for (const auto& vm_class : program.classes) {
+        names.insert(vm_class.name);
+    }
+    return names;
+}
+
+// Whether the code from position start on may use the that segment before it
+// sets pointer 1 again. A call keeps the caller's pointer 1, so compiled code
+// may set it before a call and use it after; code that replaces a call with
+// commands that set pointer 1 has to keep it if this is true.
+bool uses_that_before_set(const vector<VmInstruction>& body, size_t start) {
+    for (size_t i = start; i < body.size(); i++) {
+        const VmInstruction& instruction = body[i];
+        if (instruction.is(VmOp::POP, Segment::POINTER, 1) || instruction.op == VmOp::RETURN) return false;
+        if (instruction.segment == Segment::THAT || instruction.is(VmOp::PUSH, Segment::POINTER, 1)) return true;
+    }
+    return false;
+}
+
+string to_vm_text(const VmInstruction& instruction) {
+    string text = VM_OP_NAMES[static_cast<int>(instruction.op)];
+    switch (instruction.op) {
+        case VmOp::PUSH:
+        case VmOp::POP:
+            text += " " + SEGMENT_NAMES[static_cast<int>(instruction.segment)] + " " + to_string(instruction.index);
+            break;
+        case VmOp::LABEL:
+        case VmOp::GOTO:
+        case VmOp::IF_GOTO:
+            text += " " + instruction.name;
+            break;
+        case VmOp::FUNCTION:
+        case VmOp::CALL:
+            text += " " + instruction.name + " " + to_string(instruction.index);
+            break;
+        default:
+            break;
+    }
+    return text;
+}
+
+string to_vm_text(const VmClass& vm_class) {
+    stringstream output;
+    for (const auto& function : vm_class.functions) {
+        output << "function " << function.name << " " << function.n_locals << '\n';
+        for (const auto& instruction : function.body) {
+            output << to_vm_text(instruction) << '\n';
+        }
+    }
+    return output.str();
+}
+
+// Reads VM text (as written by to_vm_text or any other Jack compiler) into
+// vm_class. Returns false and reports the line on malformed input.
+bool parse_vm_text(istream& input, VmClass& vm_class) {
+    string line;
+    int line_number = 0;
+    while (getline(input, line)) {
+        line_number++;
+        auto comment_pos = line.find("//");
+        if (comment_pos != string::npos) {
+            line = line.substr(0, comment_pos);
+        }
+
+        stringstream line_stream(line);
+        string command;
+        if (!(line_stream >> command)) continue;
+
+        string first;
+        string second;
+        line_stream >> first >> second;
+
+        bool valid = true;
+        if (command == "function") {
+            try {
+                vm_class.functions.push_back({first, stoi(second), -1, {}});
+            } catch (const exception&) {
+                valid = false;
+            }
+        } else if (vm_class.functions.empty()) {
+            valid = false;
+        } else if (command == "push" || command == "pop") {
+            VmOp op = command == "push" ? VmOp::PUSH : VmOp::POP;
+            try {
+                valid = SEGMENTS.find(first) != SEGMENTS.end();
+                if (valid) {
+                    vm_class.functions.back().body.push_back({op, SEGMENTS.at(first), stoi(second), ""});
+                }
+            } catch (const exception&) {
+                valid = false;
+            }
+        } else if (ARITHMETIC_OPS.find(command) != ARITHMETIC_OPS.end()) {
+            vm_class.functions.back().body.push_back(VmInstruction::arithmetic(ARITHMETIC_OPS.at(command)));
+        } else if (command == "label") {
+            vm_class.functions.back().body.push_back(VmInstruction::label(first));
+        } else if (command == "goto") {
+            vm_class.functions.back().body.push_back(VmInstruction::jump(VmOp::GOTO, first));
+        } else if (command == "if-goto") {
+            vm_class.functions.back().body.push_back(VmInstruction::jump(VmOp::IF_GOTO, first));
+        } else if (command == "call") {
+            try {
+                vm_class.functions.back().body.push_back(VmInstruction::call(first, stoi(second)));
+            } catch (const exception&) {
+                valid = false;
+            }
+        } else if (command == "return") {
+            vm_class.functions.back().body.push_back(VmInstruction::ret());
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            LOG_ERROR("Invalid VM command in " << vm_class.name << " on line " << line_number << ": " << line);
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // VM_CODE_CPP
\ No newline at end of file
@@ -0,0 +1,610 @@
+#ifndef VM_INTERPRETER_CPP
+#define VM_INTERPRETER_CPP
+
+#include "constants.h"
+#include "vm_code.cpp"
+#include "vm_os.cpp"
+#include "hack_backend.cpp"
+#include "profile.cpp"
+#include "log.cpp"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+#if defined(__GNUC__)
+#define USE_COMPUTED_GOTO
+#endif
+
+static const int STACK_BASE = 256;
+static const int STATIC_BASE = 16;
+static const int STATIC_END = 256;
+static const int TEMP_BASE = 5;
+
+// Handlers of the pre-decoded program, one per VM command and segment.
+enum Handler {
+    H_HALT,
+    H_FUNCTION,
+    H_PUSH_CONSTANT,
+    H_PUSH_LOCAL,
+    H_PUSH_ARGUMENT,
+    H_PUSH_THIS,
+    H_PUSH_THAT,
+    H_PUSH_ADDRESS,
+    H_PUSH_THIS_POINTER,
+    H_PUSH_THAT_POINTER,
+    H_POP_LOCAL,
+    H_POP_ARGUMENT,
+    H_POP_THIS,
+    H_POP_THAT,
+    H_POP_ADDRESS,
+    H_POP_THIS_POINTER,
+    H_POP_THAT_POINTER,
+    H_ADD,
+    H_SUB,
+    H_NEG,
+    H_EQ,
+    H_GT,
+    H_LT,
+    H_AND,
+    H_OR,
+    H_NOT,
+    H_GOTO,
+    H_IF_GOTO,
+    H_CALL,
+    H_CALL_NATIVE,
+    H_RETURN
+};
+
+// A VM command with everything resolved up front: operand is the constant,
+// segment index, absolute static/temp address, jump target, callee entry or
+// native routine; n_args is the argument count of calls. Function entries
+// hold the local count in operand and the most the function's stack grows
+// past its locals in n_args.
+struct DecodedInstruction {
+    Handler handler;
+    int operand;
+    int n_args;
+    int cycles;
+};
+
+struct RunResult {
+    bool ok;
+    int error_code;
+    long long instructions;
+    long long cycles;
+    long long native_calls;
+};
+
+// Runs a VmProgram directly. The program is decoded once into a flat array
+// with labels, callees and static addresses resolved, and executed with
+// computed-goto dispatch where the compiler supports it. OS routines the
+// program does not define itself are provided by NativeOs. Function entries,
+// calls and if-gotos are counted for collect_profile.
+//
+// Programs may come from .vm and .vmb files, so load() rejects segment
+// indices outside their segment and functions that pop more than they
+// pushed or reach a command with different stack depths. Each function's
+// deepest stack is then known, and running out of stack is checked once per
+// call instead of on every push.
+class VmInterpreter
+{
+public:
+    VmInterpreter(const VmProgram& program) {
+        this->program = &program;
+    }
+
+    bool load() {
+        code.clear();
+        sources.clear();
+        owners.clear();
+        function_names.clear();
+        code.push_back({H_HALT, 0, 0, 0});
+        sources.push_back(nullptr);
+        owners.push_back(-1);
+
+        unordered_map<string, int> entries;
+        int next_static = STATIC_BASE;
+        for (const auto& vm_class : program->classes) {
+            int static_count = 0;
+            for (const auto& function : vm_class.functions) {
+                for (const auto& instruction : function.body) {
+                    if (instruction.segment == Segment::STATIC) {
+                        static_count = max(static_count, instruction.index + 1);
+                    }
+                }
+            }
+            static_bases[vm_class.name] = next_static;
+            next_static += static_count;
+        }
+        if (next_static > STATIC_END) {
+            LOG_ERROR("Too many static variables: " << next_static - STATIC_BASE);
+            return false;
+        }
+
+        // first pass: lay out functions and labels
+        int address = code.size();
+        for (const auto& vm_class : program->classes) {
+            for (const auto& function : vm_class.functions) {
+                entries[function.name] = address++;
+                for (const auto& instruction : function.body) {
+                    if (instruction.op == VmOp::LABEL) {
+                        labels[function.name + "$" + instruction.name] = address;
+                    } else {
+                        address++;
+                    }
+                }
+            }
+        }
+
+        HackBackend cost_model(false, false);
+        for (const auto& vm_class : program->classes) {
+            int static_base = static_bases[vm_class.name];
+            for (const auto& function : vm_class.functions) {
+                int owner = function_names.size();
+                function_names.push_back(function.name);
+                int max_depth = 0;
+                if (function.n_locals < 0 || !stack_depth(function, max_depth)) return false;
+                code.push_back({H_FUNCTION, function.n_locals, max_depth, cost_model.estimate_cycles({VmOp::FUNCTION, Segment::NONE, function.n_locals, ""})});
+                sources.push_back(nullptr);
+                owners.push_back(owner);
+                for (const auto& instruction : function.body) {
+                    if (instruction.op == VmOp::LABEL) continue;
+                    DecodedInstruction decoded{H_HALT, instruction.index, 0, cost_model.estimate_cycles(instruction)};
+                    if (!decode(instruction, function, static_base, entries, decoded)) return false;
+                    code.push_back(decoded);
+                    sources.push_back(&instruction);
+                    owners.push_back(owner);
+                }
+            }
+        }
+
+        if (entries.find("Sys.init") != entries.end()) {
+            entry = entries.at("Sys.init");
+        } else if (entries.find("Main.main") != entries.end()) {
+            entry = entries.at("Main.main");
+        } else {
+            LOG_ERROR("Program has neither Sys.init nor Main.main.");
+            return false;
+        }
+        if (code.size() > 0xFFFF) {
+            LOG_ERROR("Program is too large to run: " << code.size() << " commands.");
+            return false;
+        }
+        return true;
+    }
+
+    RunResult run(long long max_instructions) {
+        vector<int16_t> memory(RAM_SIZE, 0);
+        int16_t* ram = memory.data();
+        NativeOs os(ram);
+
+        // call the entry point with a return address of 0, which halts
+        int sp = STACK_BASE;
+        ram[sp++] = 0;
+        ram[sp++] = 0;
+        ram[sp++] = 0;
+        ram[sp++] = 0;
+        ram[sp++] = 0;
+        int lcl = sp;
+        int arg = sp - 5;
+        int16_t this_pointer = 0;
+        int16_t that_pointer = 0;
+
+        long long instructions = 0;
+        long long cycles = 0;
+        long long native_calls = 0;
+        bool limit_reached = false;
+        bool stack_overflow = false;
+        const DecodedInstruction* base = code.data();
+        const DecodedInstruction* ip = base + entry;
+        executions.assign(code.size(), 0);
+        taken.assign(code.size(), 0);
+        long long* executed_count = executions.data();
+        long long* taken_count = taken.data();
+
+#ifdef USE_COMPUTED_GOTO
+        static void* dispatch_table[] = {
+            &&L_HALT, &&L_FUNCTION,
+            &&L_PUSH_CONSTANT, &&L_PUSH_LOCAL, &&L_PUSH_ARGUMENT, &&L_PUSH_THIS, &&L_PUSH_THAT,
+            &&L_PUSH_ADDRESS, &&L_PUSH_THIS_POINTER, &&L_PUSH_THAT_POINTER,
+            &&L_POP_LOCAL, &&L_POP_ARGUMENT, &&L_POP_THIS, &&L_POP_THAT,
+            &&L_POP_ADDRESS, &&L_POP_THIS_POINTER, &&L_POP_THAT_POINTER,
+            &&L_ADD, &&L_SUB, &&L_NEG, &&L_EQ, &&L_GT, &&L_LT, &&L_AND, &&L_OR, &&L_NOT,
+            &&L_GOTO, &&L_IF_GOTO, &&L_CALL, &&L_CALL_NATIVE, &&L_RETURN
+        };
+#define CASE(name) L_##name:
+#define DISPATCH() instructions++; cycles += ip->cycles; goto *dispatch_table[ip->handler]
+#define NEXT() ip++; DISPATCH()
+        DISPATCH();
+#else
+#define CASE(name) case H_##name:
+#define DISPATCH() continue
+#define NEXT() ip++; continue
+        for (;;) {
+        instructions++;
+        cycles += ip->cycles;
+        switch (ip->handler) {
+#endif
+
+        CASE(HALT)
+            goto done;
+        CASE(FUNCTION)
+            if (sp + ip->operand + ip->n_args >= HEAP_BASE) {
+                stack_overflow = true;
+                goto done;
+            }
+            executed_count[ip - base]++;
+            for (int i = 0; i < ip->operand; i++) ram[sp++] = 0;
+            NEXT();
+        CASE(PUSH_CONSTANT)
+            ram[sp++] = ip->operand;
+            NEXT();
+        CASE(PUSH_LOCAL)
+            ram[sp++] = ram[lcl + ip->operand];
+            NEXT();
+        CASE(PUSH_ARGUMENT)
+            ram[sp++] = ram[arg + ip->operand];
+            NEXT();
+        CASE(PUSH_THIS)
+            ram[sp++] = ram[(this_pointer + ip->operand) & (RAM_SIZE - 1)];
+            NEXT();
+        CASE(PUSH_THAT)
+            ram[sp++] = ram[(that_pointer + ip->operand) & (RAM_SIZE - 1)];
+            NEXT();
+        CASE(PUSH_ADDRESS)
+            ram[sp++] = ram[ip->operand];
+            NEXT();
+        CASE(PUSH_THIS_POINTER)
+            ram[sp++] = this_pointer;
+            NEXT();
+        CASE(PUSH_THAT_POINTER)
+            ram[sp++] = that_pointer;
+            NEXT();
+        CASE(POP_LOCAL)
+            ram[lcl + ip->operand] = ram[--sp];
+            NEXT();
+        CASE(POP_ARGUMENT)
+            ram[arg + ip->operand] = ram[--sp];
+            NEXT();
+        CASE(POP_THIS)
+            ram[(this_pointer + ip->operand) & (RAM_SIZE - 1)] = ram[--sp];
+            NEXT();
+        CASE(POP_THAT)
+            ram[(that_pointer + ip->operand) & (RAM_SIZE - 1)] = ram[--sp];
+            NEXT();
+        CASE(POP_ADDRESS)
+            ram[ip->operand] = ram[--sp];
+            NEXT();
+        CASE(POP_THIS_POINTER)
+            this_pointer = ram[--sp];
+            NEXT();
+        CASE(POP_THAT_POINTER)
+            that_pointer = ram[--sp];
+            NEXT();
+        CASE(ADD)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] + ram[sp];
+            NEXT();
+        CASE(SUB)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] - ram[sp];
+            NEXT();
+        CASE(NEG)
+            ram[sp - 1] = -ram[sp - 1];
+            NEXT();
+        CASE(EQ)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] == ram[sp] ? -1 : 0;
+            NEXT();
+        CASE(GT)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] > ram[sp] ? -1 : 0;
+            NEXT();
+        CASE(LT)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] < ram[sp] ? -1 : 0;
+            NEXT();
+        CASE(AND)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] & ram[sp];
+            NEXT();
+        CASE(OR)
+            sp--;
+            ram[sp - 1] = ram[sp - 1] | ram[sp];
+            NEXT();
+        CASE(NOT)
+            ram[sp - 1] = ~ram[sp - 1];
+            NEXT();
+        CASE(GOTO)
+            if (instructions > max_instructions) {
+                limit_reached = true;
+                goto done;
+            }
+            ip = base + ip->operand;
+            DISPATCH();
+        CASE(IF_GOTO)
+            executed_count[ip - base]++;
+            if (ram[--sp] != 0) {
+                taken_count[ip - base]++;
+                if (instructions > max_instructions) {
+                    limit_reached = true;
+                    goto done;
+                }
+                ip = base + ip->operand;
+                DISPATCH();
+            }
+            NEXT();
+        CASE(CALL) {
+            if (instructions > max_instructions) {
+                limit_reached = true;
+                goto done;
+            }
+            if (sp + 5 >= HEAP_BASE) {
+                stack_overflow = true;
+                goto done;
+            }
+            executed_count[ip - base]++;
+            int return_address = ip - base + 1;
+            ram[sp++] = static_cast<int16_t>(return_address);
+            ram[sp++] = lcl;
+            ram[sp++] = arg;
+            ram[sp++] = this_pointer;
+            ram[sp++] = that_pointer;
+            arg = sp - 5 - ip->n_args;
+            lcl = sp;
+            ip = base + ip->operand;
+            DISPATCH();
+        }
+        CASE(CALL_NATIVE) {
+            executed_count[ip - base]++;
+            native_calls++;
+            sp -= ip->n_args;
+            ram[0] = sp;
+            ram[1] = lcl;
+            ram[2] = arg;
+            ram[3] = this_pointer;
+            ram[4] = that_pointer;
+            int16_t value = os.call(static_cast<Native>(ip->operand), ram + sp);
+            ram[sp++] = value;
+            string text = os.take_output();
+            if (!text.empty()) cout << text;
+            if (os.halted) goto done;
+            NEXT();
+        }
+        CASE(RETURN) {
+            int frame = lcl;
+            int return_address = static_cast<uint16_t>(ram[frame - 5]);
+            ram[arg] = ram[sp - 1];
+            sp = arg + 1;
+            that_pointer = ram[frame - 1];
+            this_pointer = ram[frame - 2];
+            arg = ram[frame - 3];
+            lcl = ram[frame - 4];
+            ip = base + return_address;
+            DISPATCH();
+        }
+
+#ifndef USE_COMPUTED_GOTO
+        }
+        }
+#endif
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+
+    done:
+        if (limit_reached) {
+            LOG_ERROR("Stopped after " << max_instructions << " VM commands.");
+        }
+        if (stack_overflow) {
+            LOG_ERROR("Stack overflow.");
+        }
+        bool ok = !limit_reached && !stack_overflow && os.error_code == 0;
+        return {ok, os.error_code, instructions, cycles, native_calls};
+    }
+
+    // Adds the counts of the last run to profile.
+    void collect_profile(Profile& profile) const {
+        for (size_t i = 0; i < executions.size(); i++) {
+            if (executions[i] == 0) continue;
+            const string& function = function_names[owners[i]];
+            const VmInstruction* source = sources[i];
+            if (source == nullptr) {
+                profile.function_calls[function] += executions[i];
+            } else if (source->op == VmOp::CALL) {
+                profile.call_edges[function + " " + source->name] += executions[i];
+            } else if (source->op == VmOp::IF_GOTO) {
+                BranchCounts& counts = profile.branches[function + "$" + source->name];
+                counts.taken += taken[i];
+                counts.executed += executions[i];
+            }
+        }
+    }
+
+private:
+    const VmProgram* program;
+    vector<DecodedInstruction> code;
+    // per decoded command: the VM command it came from (null for function
+    // entries), the index of its function, and its profile counts
+    vector<const VmInstruction*> sources;
+    vector<int> owners;
+    vector<string> function_names;
+    vector<long long> executions;
+    vector<long long> taken;
+    unordered_map<string, int> labels;
+    unordered_map<string, int> static_bases;
+    int entry;
+
+    // Finds the deepest the stack of function gets past its locals, checking
+    // that no command pops a value the function did not push and that every
+    // way to a command reaches it with the same depth.
+    bool stack_depth(const VmFunction& function, int& max_depth) {
+        const vector<VmInstruction>& body = function.body;
+        unordered_map<string, size_t> label_positions;
+        for (size_t i = 0; i < body.size(); i++) {
+            if (body[i].op == VmOp::LABEL) label_positions[body[i].name] = i;
+        }
+
+        vector<int> depths(body.size() + 1, -1);
+        vector<size_t> pending = {0};
+        depths[0] = 0;
+        max_depth = 0;
+        while (!pending.empty()) {
+            size_t i = pending.back();
+            pending.pop_back();
+            if (i == body.size()) continue;
+            const VmInstruction& instruction = body[i];
+            int depth = depths[i];
+            int popped = 0;
+            int pushed = 0;
+            bool falls_through = true;
+            switch (instruction.op) {
+                case VmOp::PUSH: pushed = 1; break;
+                case VmOp::POP: popped = 1; break;
+                case VmOp::NEG:
+                case VmOp::NOT: popped = 1; pushed = 1; break;
+                case VmOp::IF_GOTO: popped = 1; break;
+                case VmOp::CALL: popped = instruction.index; pushed = 1; break;
+                case VmOp::RETURN: popped = 1; falls_through = false; break;
+                case VmOp::GOTO: falls_through = false; break;
+                case VmOp::LABEL:
+                case VmOp::FUNCTION: break;
+                default: popped = 2; pushed = 1; break;
+            }
+            if (popped < 0 || depth < popped) {
+                LOG_ERROR("Stack underflow in " << function.name << " at " << to_vm_text(instruction));
+                return false;
+            }
+            depth += pushed - popped;
+            max_depth = max(max_depth, depth);
+
+            vector<size_t> next;
+            if (falls_through) next.push_back(i + 1);
+            if (instruction.is_jump()) {
+                auto target = label_positions.find(instruction.name);
+                // unknown labels are reported by decode
+                if (target != label_positions.end()) next.push_back(target->second);
+            }
+            for (size_t k : next) {
+                if (depths[k] == -1) {
+                    depths[k] = depth;
+                    pending.push_back(k);
+                } else if (depths[k] != depth) {
+                    LOG_ERROR("Stack depth differs between the ways into " << function.name << " at " <<
+                              (k < body.size() ? to_vm_text(body[k]) : "its end"));
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool decode(const VmInstruction& instruction, const VmFunction& function, int static_base, const unordered_map<string, int>& entries, DecodedInstruction& decoded) {
+        const string& function_name = function.name;
+        bool is_push = instruction.op == VmOp::PUSH;
+        switch (instruction.op) {
+            case VmOp::PUSH:
+            case VmOp::POP:
+                if (instruction.index < 0) return invalid(instruction, function_name);
+                switch (instruction.segment) {
+                    case Segment::CONSTANT:
+                        if (!is_push || instruction.index > MAX_INTEGER_CONSTANT) return invalid(instruction, function_name);
+                        decoded.handler = H_PUSH_CONSTANT;
+                        break;
+                    case Segment::LOCAL:
+                        if (instruction.index >= function.n_locals) return invalid(instruction, function_name);
+                        decoded.handler = is_push ? H_PUSH_LOCAL : H_POP_LOCAL;
+                        break;
+                    case Segment::ARGUMENT:
+                        // the argument count of text VM code is not known; the
+                        // arguments start below the heap, so this keeps them in RAM
+                        if (instruction.index >= (function.n_args >= 0 ? function.n_args : RAM_SIZE - HEAP_BASE)) {
+                            return invalid(instruction, function_name);
+                        }
+                        decoded.handler = is_push ? H_PUSH_ARGUMENT : H_POP_ARGUMENT;
+                        break;
+                    case Segment::THIS:
+                        decoded.handler = is_push ? H_PUSH_THIS : H_POP_THIS;
+                        break;
+                    case Segment::THAT:
+                        decoded.handler = is_push ? H_PUSH_THAT : H_POP_THAT;
+                        break;
+                    case Segment::STATIC:
+                        decoded.handler = is_push ? H_PUSH_ADDRESS : H_POP_ADDRESS;
+                        decoded.operand = static_base + instruction.index;
+                        break;
+                    case Segment::TEMP:
+                        if (instruction.index > 7) return invalid(instruction, function_name);
+                        decoded.handler = is_push ? H_PUSH_ADDRESS : H_POP_ADDRESS;
+                        decoded.operand = TEMP_BASE + instruction.index;
+                        break;
+                    case Segment::POINTER:
+                        if (instruction.index > 1) return invalid(instruction, function_name);
+                        if (instruction.index == 0) {
+                            decoded.handler = is_push ? H_PUSH_THIS_POINTER : H_POP_THIS_POINTER;
+                        } else {
+                            decoded.handler = is_push ? H_PUSH_THAT_POINTER : H_POP_THAT_POINTER;
+                        }
+                        break;
+                    case Segment::NONE:
+                        return invalid(instruction, function_name);
+                }
+                break;
+            case VmOp::ADD: decoded.handler = H_ADD; break;
+            case VmOp::SUB: decoded.handler = H_SUB; break;
+            case VmOp::NEG: decoded.handler = H_NEG; break;
+            case VmOp::EQ: decoded.handler = H_EQ; break;
+            case VmOp::GT: decoded.handler = H_GT; break;
+            case VmOp::LT: decoded.handler = H_LT; break;
+            case VmOp::AND: decoded.handler = H_AND; break;
+            case VmOp::OR: decoded.handler = H_OR; break;
+            case VmOp::NOT: decoded.handler = H_NOT; break;
+            case VmOp::GOTO:
+            case VmOp::IF_GOTO: {
+                auto target = labels.find(function_name + "$" + instruction.name);
+                if (target == labels.end()) {
+                    LOG_ERROR("Unknown label " << instruction.name << " in " << function_name);
+                    return false;
+                }
+                decoded.handler = instruction.op == VmOp::GOTO ? H_GOTO : H_IF_GOTO;
+                decoded.operand = target->second;
+                break;
+            }
+            case VmOp::CALL: {
+                if (instruction.index < 0) return invalid(instruction, function_name);
+                decoded.n_args = instruction.index;
+                auto callee = entries.find(instruction.name);
+                if (callee != entries.end()) {
+                    decoded.handler = H_CALL;
+                    decoded.operand = callee->second;
+                } else if (NATIVES.find(instruction.name) != NATIVES.end()) {
+                    decoded.handler = H_CALL_NATIVE;
+                    decoded.operand = static_cast<int>(NATIVES.at(instruction.name));
+                } else {
+                    LOG_ERROR("Unknown function " << instruction.name << " called in " << function_name);
+                    return false;
+                }
+                break;
+            }
+            case VmOp::RETURN:
+                decoded.handler = H_RETURN;
+                break;
+            case VmOp::LABEL:
+            case VmOp::FUNCTION:
+                return invalid(instruction, function_name);
+        }
+        return true;
+    }
+
+    bool invalid(const VmInstruction& instruction, const string& function_name) {
+        LOG_ERROR("Invalid VM command in " << function_name << ": " << to_vm_text(instruction));
+        return false;
+    }
+
+};
+
+#endif // VM_INTERPRETER_CPP
\ No newline at end of file
@@ -0,0 +1,427 @@
+#ifndef VM_OS_CPP
+#define VM_OS_CPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace std;
+
+static const int RAM_SIZE = 32768;
+static const int HEAP_BASE = 2048;
+static const int HEAP_END = 16384;
+static const int SCREEN_BASE = 16384;
+static const int SCREEN_SIZE = 8192;
+static const int KEYBOARD_ADDRESS = 24576;
+
+// Sys.error codes of the standard Jack OS
+static const int ERROR_ARRAY_SIZE = 2;
+static const int ERROR_DIVIDE_BY_ZERO = 3;
+static const int ERROR_SQRT_NEGATIVE = 4;
+static const int ERROR_ALLOC_SIZE = 5;
+static const int ERROR_HEAP_OVERFLOW = 6;
+static const int ERROR_STRING_LENGTH = 14;
+static const int ERROR_STRING_INDEX = 15;
+static const int ERROR_STRING_FULL = 17;
+static const int ERROR_STRING_EMPTY = 18;
+
+enum class Native {
+    MATH_INIT,
+    MATH_ABS,
+    MATH_MULTIPLY,
+    MATH_DIVIDE,
+    MATH_MIN,
+    MATH_MAX,
+    MATH_SQRT,
+    MEMORY_INIT,
+    MEMORY_PEEK,
+    MEMORY_POKE,
+    MEMORY_ALLOC,
+    MEMORY_DEALLOC,
+    ARRAY_NEW,
+    ARRAY_DISPOSE,
+    STRING_INIT,
+    STRING_NEW,
+    STRING_DISPOSE,
+    STRING_LENGTH,
+    STRING_CHAR_AT,
+    STRING_SET_CHAR_AT,
+    STRING_APPEND_CHAR,
+    STRING_ERASE_LAST_CHAR,
+    STRING_INT_VALUE,
+    STRING_SET_INT,
+    STRING_BACKSPACE,
+    STRING_DOUBLE_QUOTE,
+    STRING_NEWLINE,
+    OUTPUT_INIT,
+    OUTPUT_MOVE_CURSOR,
+    OUTPUT_PRINT_CHAR,
+    OUTPUT_PRINT_STRING,
+    OUTPUT_PRINT_INT,
+    OUTPUT_PRINTLN,
+    OUTPUT_BACKSPACE,
+    SCREEN_INIT,
+    SCREEN_CLEAR,
+    SCREEN_SET_COLOR,
+    SCREEN_DRAW_PIXEL,
+    SCREEN_DRAW_LINE,
+    SCREEN_DRAW_RECTANGLE,
+    SCREEN_DRAW_CIRCLE,
+    KEYBOARD_INIT,
+    KEYBOARD_KEY_PRESSED,
+    KEYBOARD_READ_CHAR,
+    KEYBOARD_READ_LINE,
+    KEYBOARD_READ_INT,
+    SYS_INIT,
+    SYS_HALT,
+    SYS_ERROR,
+    SYS_WAIT
+};
+
+static const unordered_map<string, Native> NATIVES = {
+    {"Math.init", Native::MATH_INIT},
+    {"Math.abs", Native::MATH_ABS},
+    {"Math.multiply", Native::MATH_MULTIPLY},
+    {"Math.divide", Native::MATH_DIVIDE},
+    {"Math.min", Native::MATH_MIN},
+    {"Math.max", Native::MATH_MAX},
+    {"Math.sqrt", Native::MATH_SQRT},
+    {"Memory.init", Native::MEMORY_INIT},
+    {"Memory.peek", Native::MEMORY_PEEK},
+    {"Memory.poke", Native::MEMORY_POKE},
+    {"Memory.alloc", Native::MEMORY_ALLOC},
+    {"Memory.deAlloc", Native::MEMORY_DEALLOC},
+    {"Array.new", Native::ARRAY_NEW},
+    {"Array.dispose", Native::ARRAY_DISPOSE},
+    {"String.init", Native::STRING_INIT},
+    {"String.new", Native::STRING_NEW},
+    {"String.dispose", Native::STRING_DISPOSE},
+    {"String.length", Native::STRING_LENGTH},
+    {"String.charAt", Native::STRING_CHAR_AT},
+    {"String.setCharAt", Native::STRING_SET_CHAR_AT},
+    {"String.appendChar", Native::STRING_APPEND_CHAR},
+    {"String.eraseLastChar", Native::STRING_ERASE_LAST_CHAR},
+    {"String.intValue", Native::STRING_INT_VALUE},
+    {"String.setInt", Native::STRING_SET_INT},
+    {"String.backSpace", Native::STRING_BACKSPACE},
+    {"String.doubleQuote", Native::STRING_DOUBLE_QUOTE},
+    {"String.newLine", Native::STRING_NEWLINE},
+    {"Output.init", Native::OUTPUT_INIT},
+    {"Output.moveCursor", Native::OUTPUT_MOVE_CURSOR},
+    {"Output.printChar", Native::OUTPUT_PRINT_CHAR},
+    {"Output.printString", Native::OUTPUT_PRINT_STRING},
+    {"Output.printInt", Native::OUTPUT_PRINT_INT},
+    {"Output.println", Native::OUTPUT_PRINTLN},
+    {"Output.backSpace", Native::OUTPUT_BACKSPACE},
+    {"Screen.init", Native::SCREEN_INIT},
+    {"Screen.clearScreen", Native::SCREEN_CLEAR},
+    {"Screen.setColor", Native::SCREEN_SET_COLOR},
+    {"Screen.drawPixel", Native::SCREEN_DRAW_PIXEL},
+    {"Screen.drawLine", Native::SCREEN_DRAW_LINE},
+    {"Screen.drawRectangle", Native::SCREEN_DRAW_RECTANGLE},
+    {"Screen.drawCircle", Native::SCREEN_DRAW_CIRCLE},
+    {"Keyboard.init", Native::KEYBOARD_INIT},
+    {"Keyboard.keyPressed", Native::KEYBOARD_KEY_PRESSED},
+    {"Keyboard.readChar", Native::KEYBOARD_READ_CHAR},
+    {"Keyboard.readLine", Native::KEYBOARD_READ_LINE},
+    {"Keyboard.readInt", Native::KEYBOARD_READ_INT},
+    {"Sys.init", Native::SYS_INIT},
+    {"Sys.halt", Native::SYS_HALT},
+    {"Sys.error", Native::SYS_ERROR},
+    {"Sys.wait", Native::SYS_WAIT},
+};
+
+// Native implementation of the Jack OS for the VM interpreter. Objects live in
+// the interpreter's RAM like they would on the Hack computer: the heap is a
+// free list in RAM[2048..16383], a String is [length, capacity, characters...]
+// and the screen is the usual 512x256 bitmap at RAM[16384]. Output goes to
+// standard output and the keyboard reads lines from standard input.
+class NativeOs
+{
+public:
+    NativeOs(int16_t* ram) {
+        this->ram = ram;
+        memory_init();
+    }
+
+    bool halted = false;
+    int error_code = 0;
+
+    // Runs a native routine; args points at its arguments on the stack.
+    int16_t call(Native native, const int16_t* args) {
+        switch (native) {
+            case Native::MATH_INIT:
+            case Native::STRING_INIT:
+            case Native::OUTPUT_INIT:
+            case Native::SCREEN_INIT:
+            case Native::KEYBOARD_INIT:
+            case Native::SYS_WAIT:
+            case Native::OUTPUT_MOVE_CURSOR:
+                return 0;
+            case Native::MATH_ABS:
+                return args[0] < 0 ? -args[0] : args[0];
+            case Native::MATH_MULTIPLY:
+                return args[0] * args[1];
+            case Native::MATH_DIVIDE:
+                if (args[1] == 0) return error(ERROR_DIVIDE_BY_ZERO);
+                return args[0] / args[1];
+            case Native::MATH_MIN:
+                return min(args[0], args[1]);
+            case Native::MATH_MAX:
+                return max(args[0], args[1]);
+            case Native::MATH_SQRT: {
+                if (args[0] < 0) return error(ERROR_SQRT_NEGATIVE);
+                int root = 0;
+                while ((root + 1) * (root + 1) <= args[0]) root++;
+                return root;
+            }
+            case Native::MEMORY_INIT:
+                memory_init();
+                return 0;
+            case Native::MEMORY_PEEK:
+                return ram[address(args[0])];
+            case Native::MEMORY_POKE:
+                ram[address(args[0])] = args[1];
+                return 0;
+            case Native::MEMORY_ALLOC:
+                return alloc(args[0], ERROR_ALLOC_SIZE);
+            case Native::ARRAY_NEW:
+                return alloc(args[0], ERROR_ARRAY_SIZE);
+            case Native::MEMORY_DEALLOC:
+            case Native::ARRAY_DISPOSE:
+            case Native::STRING_DISPOSE:
+                dealloc(args[0]);
+                return 0;
+            case Native::STRING_NEW: {
+                if (args[0] < 0) return error(ERROR_STRING_LENGTH);
+                int16_t object = alloc(args[0] + 2, ERROR_STRING_LENGTH);
+                if (halted) return 0;
+                ram[address(object)] = 0;
+                ram[address(object + 1)] = args[0];
+                return object;
+            }
+            case Native::STRING_LENGTH:
+                return ram[address(args[0])];
+            case Native::STRING_CHAR_AT:
+                if (args[1] < 0 || args[1] >= ram[address(args[0])]) return error(ERROR_STRING_INDEX);
+                return ram[address(args[0] + 2 + args[1])];
+            case Native::STRING_SET_CHAR_AT:
+                if (args[1] < 0 || args[1] >= ram[address(args[0])]) return error(ERROR_STRING_INDEX);
+                ram[address(args[0] + 2 + args[1])] = args[2];
+                return 0;
+            case Native::STRING_APPEND_CHAR: {
+                int16_t length = ram[address(args[0])];
+                if (length >= ram[address(args[0] + 1)]) return error(ERROR_STRING_FULL);
+                ram[address(args[0] + 2 + length)] = args[1];
+                ram[address(args[0])] = length + 1;
+                return args[0];
+            }
+            case Native::STRING_ERASE_LAST_CHAR:
+                if (ram[address(args[0])] == 0) return error(ERROR_STRING_EMPTY);
+                ram[address(args[0])]--;
+                return 0;
+            case Native::STRING_INT_VALUE:
+                return stoi_prefix(to_text(args[0]));
+            case Native::STRING_SET_INT: {
+                string digits = to_string(args[1]);
+                if ((int)digits.length() > ram[address(args[0] + 1)]) return error(ERROR_STRING_FULL);
+                set_text(args[0], digits);
+                return 0;
+            }
+            case Native::STRING_BACKSPACE:
+                return 129;
+            case Native::STRING_DOUBLE_QUOTE:
+                return 34;
+            case Native::STRING_NEWLINE:
+                return 128;
+            case Native::OUTPUT_PRINT_CHAR:
+                print_char(args[0]);
+                return 0;
+            case Native::OUTPUT_PRINT_STRING:
+                for (char c : to_text(args[0])) print_char(c);
+                return 0;
+            case Native::OUTPUT_PRINT_INT:
+                output += to_string(args[0]);
+                return 0;
+            case Native::OUTPUT_PRINTLN:
+                print_char(128);
+                return 0;
+            case Native::OUTPUT_BACKSPACE:
+                print_char(129);
+                return 0;
+            case Native::SCREEN_CLEAR:
+                for (int i = 0; i < SCREEN_SIZE; i++) ram[SCREEN_BASE + i] = 0;
+                return 0;
+            case Native::SCREEN_SET_COLOR:
+                color = args[0] != 0;
+                return 0;
+            case Native::SCREEN_DRAW_PIXEL:
+                draw_pixel(args[0], args[1]);
+                return 0;
+            case Native::SCREEN_DRAW_LINE:
+                draw_line(args[0], args[1], args[2], args[3]);
+                return 0;
+            case Native::SCREEN_DRAW_RECTANGLE:
+                for (int y = args[1]; y <= args[3]; y++) {
+                    for (int x = args[0]; x <= args[2]; x++) draw_pixel(x, y);
+                }
+                return 0;
+            case Native::SCREEN_DRAW_CIRCLE:
+                for (int dy = -args[2]; dy <= args[2]; dy++) {
+                    int dx = 0;
+                    while ((dx + 1) * (dx + 1) + dy * dy <= args[2] * args[2]) dx++;
+                    for (int x = args[0] - dx; x <= args[0] + dx; x++) draw_pixel(x, args[1] + dy);
+                }
+                return 0;
+            case Native::KEYBOARD_KEY_PRESSED:
+                return 0;
+            case Native::KEYBOARD_READ_CHAR: {
+                int c = cin.get();
+                return c == EOF ? 0 : (c == '\n' ? 128 : c);
+            }
+            case Native::KEYBOARD_READ_LINE:
+            case Native::KEYBOARD_READ_INT: {
+                output += to_text(args[0]);
+                string line;
+                getline(cin, line);
+                if (native == Native::KEYBOARD_READ_INT) return stoi_prefix(line);
+                int16_t object = alloc(line.length() + 2, ERROR_STRING_LENGTH);
+                if (halted) return 0;
+                ram[address(object + 1)] = line.length();
+                set_text(object, line);
+                return object;
+            }
+            case Native::SYS_INIT:
+            case Native::SYS_HALT:
+                halted = true;
+                return 0;
+            case Native::SYS_ERROR:
+                return error(args[0]);
+        }
+        return 0;
+    }
+
+    // Text written by Output since the last call.
+    string take_output() {
+        string text = output;
+        output.clear();
+        return text;
+    }
+
+private:
+    int16_t* ram;
+    int free_list;
+    bool color = true;
+    string output;
+
+    static int address(int value) {
+        return value & (RAM_SIZE - 1);
+    }
+
+    int16_t error(int code) {
+        output += "ERR" + to_string(code) + "\n";
+        error_code = code;
+        halted = true;
+        return 0;
+    }
+
+    // Heap blocks start with their size (header included); free blocks keep
+    // the next free block in their second word.
+    void memory_init() {
+        free_list = HEAP_BASE;
+        ram[HEAP_BASE] = HEAP_END - HEAP_BASE;
+        ram[HEAP_BASE + 1] = 0;
+    }
+
+    int16_t alloc(int size, int error_code) {
+        if (size <= 0) return error(error_code);
+        int needed = size + 1;
+        int previous = 0;
+        for (int block = free_list; block != 0; previous = block, block = ram[block + 1]) {
+            int block_size = ram[block];
+            if (block_size >= needed + 2) {
+                ram[block] = block_size - needed;
+                int allocated = block + ram[block];
+                ram[allocated] = needed;
+                return allocated + 1;
+            }
+            if (block_size >= needed) {
+                if (previous == 0) free_list = ram[block + 1];
+                else ram[previous + 1] = ram[block + 1];
+                return block + 1;
+            }
+        }
+        return error(ERROR_HEAP_OVERFLOW);
+    }
+
+    void dealloc(int16_t object) {
+        int block = object - 1;
+        if (block < HEAP_BASE || block >= HEAP_END) return;
+        ram[block + 1] = free_list;
+        free_list = block;
+    }
+
+    string to_text(int16_t object) {
+        string text;
+        int length = ram[address(object)];
+        for (int i = 0; i < length; i++) {
+            text += static_cast<char>(ram[address(object + 2 + i)]);
+        }
+        return text;
+    }
+
+    void set_text(int16_t object, const string& text) {
+        for (size_t i = 0; i < text.length(); i++) {
+            ram[address(object + 2 + i)] = text[i];
+        }
+        ram[address(object)] = text.length();
+    }
+
+    static int16_t stoi_prefix(const string& text) {
+        return static_cast<int16_t>(atoi(text.c_str()));
+    }
+
+    void print_char(int c) {
+        if (c == 128) {
+            output += '\n';
+        } else if (c == 129) {
+            if (!output.empty()) output.pop_back();
+        } else {
+            output += static_cast<char>(c);
+        }
+    }
+
+    void draw_pixel(int x, int y) {
+        if (x < 0 || x >= 512 || y < 0 || y >= 256) return;
+        int16_t& word = ram[SCREEN_BASE + y * 32 + x / 16];
+        int16_t bit = static_cast<int16_t>(1 << (x % 16));
+        word = color ? (word | bit) : (word & ~bit);
+    }
+
+    void draw_line(int x1, int y1, int x2, int y2) {
+        int dx = abs(x2 - x1);
+        int dy = -abs(y2 - y1);
+        int step_x = x1 < x2 ? 1 : -1;
+        int step_y = y1 < y2 ? 1 : -1;
+        int error = dx + dy;
+        while (true) {
+            draw_pixel(x1, y1);
+            if (x1 == x2 && y1 == y2) return;
+            int doubled = 2 * error;
+            if (doubled >= dy) {
+                error += dy;
+                x1 += step_x;
+            }
+            if (doubled <= dx) {
+                error += dx;
+                y1 += step_y;
+            }
+        }
+    }
+
+};
+
+#endif // VM_OS_CPP
\ No newline at end of file